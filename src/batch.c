@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include "batch.h"
+
+sim_batch *sim_batch_create(int count, int width, int height, int threads){
+    if(count <= 0) return NULL;
+
+    sim_batch *batch = (sim_batch *) calloc(1, sizeof(sim_batch));
+    if(!batch) return NULL;
+
+    batch->count = count;
+    batch->worlds = (sand_simulation **) calloc(count, sizeof(sand_simulation *));
+    if(!batch->worlds){
+        sim_batch_destroy(batch);
+        return NULL;
+    }
+
+    for(int k = 0; k < count; k++){
+        batch->worlds[k] = sim_create(width, height);
+        if(!batch->worlds[k]){
+            sim_batch_destroy(batch);
+            return NULL;
+        }
+    }
+
+    if(threads > 1){
+        batch->pool = thread_pool_create(threads);
+    }
+    return batch;
+}
+
+void sim_batch_destroy(sim_batch *batch){
+    if(!batch) return;
+
+    if(batch->worlds){
+        for(int k = 0; k < batch->count; k++){
+            sim_destroy(batch->worlds[k]);
+        }
+        free(batch->worlds);
+    }
+    thread_pool_destroy(batch->pool);
+    free(batch);
+}
+
+void sim_batch_seed(sim_batch *batch, uint64_t seed){
+    for(int k = 0; k < batch->count; k++){
+        sim_seed(batch->worlds[k], seed + k);
+    }
+}
+
+// Worlds have no pool of their own, so the
+// whole run stays on the thread that took it
+static void step_world(void *arg, int k){
+    sim_batch *batch = (sim_batch *) arg;
+    for(int t = 0; t < batch->ticks; t++){
+        sim_step(batch->worlds[k]);
+    }
+}
+
+void sim_batch_step(sim_batch *batch, int ticks){
+    batch->ticks = ticks;
+    thread_pool_run(batch->pool, step_world, batch, batch->count);
+}
@@ -0,0 +1,31 @@
+#ifndef __BATCHH__
+#define __BATCHH__
+
+#include <stdint.h>
+#include "particle.h"
+#include "thread_pool.h"
+
+// Many independent worlds stepped on one pool. Each world is
+// stepped by a single thread, a call to sim_batch_step hands
+// whole worlds to the threads and idle threads steal the ones
+// not started yet.
+typedef struct {
+    int count;
+    sand_simulation **worlds;
+    thread_pool *pool;
+
+    // Ticks of the current sim_batch_step call
+    int ticks;
+} sim_batch;
+
+// Returns NULL if any world can't be created
+sim_batch *sim_batch_create(int count, int width, int height, int threads);
+void sim_batch_destroy(sim_batch *batch);
+
+// World k is seeded with seed + k
+void sim_batch_seed(sim_batch *batch, uint64_t seed);
+
+// Steps every world ticks times
+void sim_batch_step(sim_batch *batch, int ticks);
+
+#endif
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "batch.h"
+#include "tools.h"
+#include "timing.h"
+
+// Steps many small worlds at once and prints the combined throughput.
+// Usage: sand-sim-batch [worlds] [size] [ticks] [threads] [seed]
+
+int main(int argc, char **argv){
+    int count = argc > 1 ? atoi(argv[1]) : 64;
+    int size = argc > 2 ? atoi(argv[2]) : 128;
+    int ticks = argc > 3 ? atoi(argv[3]) : 1000;
+    int threads = argc > 4 ? atoi(argv[4]) : cpu_count();
+    unsigned int seed = argc > 5 ? (unsigned int) atoi(argv[5]) : 1;
+
+    if(count <= 0 || size <= 0 || ticks < 0){
+        fprintf(stderr, "usage: %s [worlds] [size] [ticks] [threads] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    sim_batch *batch = sim_batch_create(count, size, size, threads);
+    if(!batch){
+        fprintf(stderr, "could not allocate %d worlds of %dx%d\n", count, size, size);
+        return 1;
+    }
+    sim_batch_seed(batch, seed);
+    // Lower half, fire on top of it
+    for(int k = 0; k < count; k++){
+        fill_world(batch->worlds[k], 0, size / 2);
+    }
+
+    double start = now_seconds();
+    sim_batch_step(batch, ticks);
+    double elapsed = now_seconds() - start;
+
+    double updated = 0;
+    int counts[material_count] = {0};
+    for(int k = 0; k < count; k++){
+        sand_simulation *sim = batch->worlds[k];
+        updated += (double) atomic_load(&sim->updated_cells);
+        for(int i = 0; i < size * size; i++){
+            counts[sim->ids[i]]++;
+        }
+    }
+
+    double world_ticks = (double) count * ticks;
+    double cells = world_ticks * size * size;
+    printf("%d worlds of %dx%d, %d ticks, %d threads: %.3f s\n", count, size, size, ticks, threads, elapsed);
+    if(elapsed > 0){
+        printf("%.1f world ticks/s, %.3f ns/cell, %.1f M updates/s\n",
+            world_ticks / elapsed, elapsed * 1e9 / cells, updated / elapsed * 1e-6);
+    }
+    for(int m = 0; m < material_count; m++){
+        printf("%-6s %d\n", materials[m].name, counts[m]);
+    }
+
+    sim_batch_destroy(batch);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "particle.h"
+#include "tools.h"
+#include "timing.h"
+
+// Runs a fixed set of scenarios on several grid sizes and prints timings.
+// Every scenario is seeded, so two runs step the exact same cells
+// and their numbers can be compared across builds.
+// Usage: sand-sim-bench [ticks] [threads] [sizes...]
+
+#define __bench_seed 1234
+
+// Bytes a sweep touches for every visited cell (id and tick stamp) and for
+// every cell a kernel runs on (p_get and p_set of id, variant, stamp, both
+// velocities and life time). Neighbour probes and wakes are left out, so the
+// bandwidth printed is a lower bound of what the step really moves.
+#define __visit_bytes 2
+#define __update_bytes (2 * (3 + 3 * sizeof(real_t)))
+
+typedef struct {
+    const char *name;
+    void (*fill)(sand_simulation *sim, int n);
+} scenario_t;
+
+// Sets every cell of [x0, x1) x [y0, y1) to a fresh particle
+void fill_rect(sand_simulation *sim, int x0, int y0, int x1, int y1, uint8_t id){
+    for(int y = y0; y < y1; y++){
+        for(int x = x0; x < x1; x++){
+            p_set(sim, new_particle(id, &sim->rng), get_index(sim, x, y));
+        }
+    }
+}
+
+/*   SCENARIOS   */
+// A block of sand in the air that falls and spreads into a pile
+void fill_sand_pile(sand_simulation *sim, int n){
+    fill_rect(sim, n / 4, n / 2, 3 * n / 4, n, sand_id);
+}
+
+// A column of water on the left wall that runs over the floor
+void fill_dam_break(sand_simulation *sim, int n){
+    fill_rect(sim, 0, 0, n / 4, 3 * n / 4, water_id);
+}
+
+// Oil trapped under water, the two layers swap places
+void fill_oil_on_water(sand_simulation *sim, int n){
+    fill_rect(sim, 0, 0, n, n / 4, oil_id);
+    fill_rect(sim, 0, n / 4, n, n / 2, water_id);
+}
+
+// Sand poured into a deep pool, every grain sinks through the water
+void fill_sand_sink(sand_simulation *sim, int n){
+    fill_rect(sim, 0, 0, n, n / 2, water_id);
+    fill_rect(sim, n / 4, n / 2, 3 * n / 4, 3 * n / 4, sand_id);
+}
+
+// A heap of coal lit from the top
+void fill_coal_burn(sand_simulation *sim, int n){
+    fill_rect(sim, n / 4, 0, 3 * n / 4, n / 2, coal_id);
+    fill_rect(sim, n / 4, n / 2, 3 * n / 4, n / 2 + 1, fire_id);
+}
+
+// Smoke and steam released from the floor
+void fill_smoke_plume(sand_simulation *sim, int n){
+    fill_rect(sim, 3 * n / 8, 0, n / 2, n / 8, smoke_id);
+    fill_rect(sim, n / 2, 0, 5 * n / 8, n / 8, steam_id);
+}
+
+// Loose grains falling through open air over the whole grid
+void fill_sandstorm(sand_simulation *sim, int n){
+    for(int y = n / 4; y < n; y++){
+        for(int x = 0; x < n; x++){
+            if(rng_next(&sim->rng) % 20 == 0){
+                p_set(sim, new_sand(), get_index(sim, x, y));
+            }
+        }
+    }
+}
+
+// Random mix over the lower half with a line of fire on top
+void fill_mixed(sand_simulation *sim, int n){
+    fill_world(sim, 0, n / 2);
+}
+
+const scenario_t scenarios[] = {
+    {"sand_pile", fill_sand_pile},
+    {"dam_break", fill_dam_break},
+    {"oil_on_water", fill_oil_on_water},
+    {"sand_sink", fill_sand_sink},
+    {"coal_burn", fill_coal_burn},
+    {"smoke_plume", fill_smoke_plume},
+    {"sandstorm", fill_sandstorm},
+    {"mixed", fill_mixed},
+};
+
+void run_scenario(const scenario_t *s, int n, int ticks, int threads){
+    sand_simulation *sim = sim_create(n, n);
+    if(!sim){
+        fprintf(stderr, "could not allocate a %dx%d world\n", n, n);
+        return;
+    }
+    sim_seed(sim, __bench_seed);
+    sim_set_threads(sim, threads);
+    s->fill(sim, n);
+
+    atomic_store(&sim->visited_cells, 0);
+    atomic_store(&sim->updated_cells, 0);
+
+    double start = now_seconds();
+    for(int t = 0; t < ticks; t++){
+        sim_step(sim);
+    }
+    double elapsed = now_seconds() - start;
+
+    double visited = (double) atomic_load(&sim->visited_cells);
+    double updated = (double) atomic_load(&sim->updated_cells);
+    double cells = (double) n * n * ticks;
+    double bytes = visited * __visit_bytes + updated * __update_bytes;
+
+    printf("%-12s %5d %10.3f %10.3f %10.1f %10.1f %10.2f\n",
+        s->name, n,
+        elapsed * 1e3 / ticks,
+        elapsed * 1e9 / cells,
+        updated / elapsed * 1e-6,
+        visited / cells * 100.0,
+        bytes / elapsed * 1e-9);
+
+    sim_destroy(sim);
+}
+
+int main(int argc, char **argv){
+    int ticks = argc > 1 ? atoi(argv[1]) : 500;
+    int threads = argc > 2 ? atoi(argv[2]) : 1;
+    int default_sizes[] = {256, 512, 1024};
+    int *sizes = default_sizes;
+    int size_count = 3;
+
+    if(argc > 3){
+        size_count = argc - 3;
+        sizes = (int *) malloc(size_count * sizeof(int));
+        if(!sizes){
+            fprintf(stderr, "could not allocate the sizes\n");
+            return 1;
+        }
+        for(int k = 0; k < size_count; k++){
+            sizes[k] = atoi(argv[k + 3]);
+        }
+    }
+
+    int valid = ticks > 0;
+    for(int k = 0; k < size_count; k++){
+        if(sizes[k] <= 0) valid = 0;
+    }
+    if(!valid){
+        fprintf(stderr, "usage: %s [ticks] [threads] [sizes...]\n", argv[0]);
+        if(sizes != default_sizes) free(sizes);
+        return 1;
+    }
+
+    printf("%d ticks, %d threads, seed %d\n", ticks, threads, __bench_seed);
+    printf("%-12s %5s %10s %10s %10s %10s %10s\n",
+        "scenario", "size", "ms/tick", "ns/cell", "Mupd/s", "swept %", "GB/s");
+    for(int k = 0; k < size_count; k++){
+        for(int s = 0; s < (int) (sizeof(scenarios) / sizeof(scenarios[0])); s++){
+            run_scenario(&scenarios[s], sizes[k], ticks, threads);
+        }
+    }
+
+    if(sizes != default_sizes) free(sizes);
+    return 0;
+}
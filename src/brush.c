@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include "brush.h"
+
+static inline int brush_allows(uint8_t target, uint8_t id){
+    if(id == empty_id) return 1;
+    if(materials[id].flags & material_burning){
+        return target == empty_id || (materials[target].flags & material_flammable);
+    }
+    return target == empty_id;
+}
+
+static inline uint32_t brush_chance(brush_t brush){
+    if(brush.density >= 1.0f) return UINT32_MAX;
+    return brush.density > 0.0f ? rng_threshold(brush.density) : 0;
+}
+
+// Paints the cells of row y in [x0, x1]
+static void paint_span(sand_simulation *sim, int y, int x0, int x1, brush_t brush, uint32_t chance){
+    if(y < 0 || y >= sim->height) return;
+    if(x0 < 0) x0 = 0;
+    if(x1 >= sim->width) x1 = sim->width - 1;
+
+    for(int x = x0; x <= x1; x++){
+        int i = get_index(sim, x, y);
+        if(!brush_allows(sim->ids[i], brush.id)) continue;
+        if(brush.density < 1.0f && !rng_chance(&sim->rng, chance)) continue;
+        p_set(sim, new_particle(brush.id, &sim->rng), i);
+    }
+}
+
+// First step s in [0, steps + 1) at which a + d * s / steps,
+// rounded, reaches bound. d >= 0 so the rounded value never
+// decreases, steps + 1 if it stays below.
+static long long first_step(long long a, long long d, long long steps, long long bound){
+    long long s0 = 0;
+    long long s1 = steps + 1;
+    while(s0 < s1){
+        long long s = s0 + (s1 - s0) / 2;
+        if(a + llround((double) d * s / steps) >= bound){
+            s1 = s;
+        }else{
+            s0 = s + 1;
+        }
+    }
+    return s0;
+}
+
+// Steps whose rounded a + d * s / steps lies in [lo, hi],
+// narrowing [*s0, *s1]. llround is symmetric, so a falling
+// coordinate is searched negated.
+static void clip_steps(long long a, long long d, long long steps, long long lo, long long hi, long long *s0, long long *s1){
+    long long first, last;
+    if(d >= 0){
+        first = first_step(a, d, steps, lo);
+        last = first_step(a, d, steps, hi + 1) - 1;
+    }else{
+        first = first_step(-a, -d, steps, -hi);
+        last = first_step(-a, -d, steps, -lo + 1) - 1;
+    }
+    if(first > *s0) *s0 = first;
+    if(last < *s1) *s1 = last;
+}
+
+// The disc is stamped at every step of the segment and each
+// row keeps the widest span the stamps cover, a stroke is
+// convex so that span is exactly its cells on the row. Only
+// steps within radius of the world can paint a cell, the rest
+// of the segment is cut off before stepping. A disc wider than
+// width + height covers the world from any cell of it, larger
+// radii are cut to that.
+void sim_paint_line(sand_simulation *sim, int x0, int y0, int x1, int y1, int radius, brush_t brush){
+    if(radius < 0) radius = 0;
+    if(radius > sim->width + sim->height) radius = sim->width + sim->height;
+    long long min_y = (long long) (y0 < y1 ? y0 : y1) - radius;
+    long long max_y = (long long) (y0 > y1 ? y0 : y1) + radius;
+    if(min_y < 0) min_y = 0;
+    if(max_y >= sim->height) max_y = sim->height - 1;
+    if(min_y > max_y) return;
+
+    long long dx = (long long) x1 - x0;
+    long long dy = (long long) y1 - y0;
+    long long steps = llabs(dx) > llabs(dy) ? llabs(dx) : llabs(dy);
+    long long s0 = 0;
+    long long s1 = steps;
+    if(steps){
+        clip_steps(x0, dx, steps, -radius, (long long) sim->width - 1 + radius, &s0, &s1);
+        clip_steps(y0, dy, steps, -radius, (long long) sim->height - 1 + radius, &s0, &s1);
+    }else if(x0 < -radius || x0 > sim->width - 1 + radius){
+        return;
+    }
+    if(s0 > s1) return;
+
+    int rows = (int) (max_y - min_y + 1);
+    int *lo = (int *) malloc(sizeof(int) * (2 * rows + radius + 1));
+    if(!lo) return;
+    int *hi = lo + rows;
+    int *half = hi + rows;
+
+    for(int r = 0; r < rows; r++){
+        lo[r] = INT_MAX;
+        hi[r] = INT_MIN;
+    }
+
+    // Cells with dx^2 + dy^2 <= radius^2 + radius, which
+    // rounds small discs better than radius^2 alone
+    for(int oy = 0; oy <= radius; oy++){
+        half[oy] = (int) sqrt((double) radius * radius + radius - oy * oy);
+    }
+
+    for(long long s = s0; s <= s1; s++){
+        int px = steps ? (int) (x0 + llround((double) dx * s / steps)) : x0;
+        int py = steps ? (int) (y0 + llround((double) dy * s / steps)) : y0;
+        for(int oy = -radius; oy <= radius; oy++){
+            long long r = (long long) py + oy - min_y;
+            if(r < 0 || r >= rows) continue;
+            int w = half[abs(oy)];
+            if(px - w < lo[r]) lo[r] = px - w;
+            if(px + w > hi[r]) hi[r] = px + w;
+        }
+    }
+
+    uint32_t chance = brush_chance(brush);
+    for(int r = 0; r < rows; r++){
+        if(lo[r] <= hi[r]){
+            paint_span(sim, min_y + r, lo[r], hi[r], brush, chance);
+        }
+    }
+    free(lo);
+}
+
+void sim_paint_circle(sand_simulation *sim, int x, int y, int radius, brush_t brush){
+    sim_paint_line(sim, x, y, x, y, radius, brush);
+}
+
+// Fills [min_x, max_x) x [min_y, max_y)
+void sim_paint_rect(sand_simulation *sim, rect_t r, brush_t brush){
+    if(r.min_x >= r.max_x) return;
+    if(r.min_y < 0) r.min_y = 0;
+    if(r.max_y > sim->height) r.max_y = sim->height;
+
+    uint32_t chance = brush_chance(brush);
+    for(int y = r.min_y; y < r.max_y; y++){
+        paint_span(sim, y, r.min_x, r.max_x - 1, brush, chance);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef __BRUSHH__
+#define __BRUSHH__
+
+#include <stdint.h>
+#include "particle.h"
+
+// Shapes are rasterized into row spans clipped to the world,
+// every cell is painted at most once per call through p_set.
+// Erasing clears any cell, fire only catches on empty and
+// flammable cells and other materials only fill empty ones.
+typedef struct {
+    uint8_t id;
+    // Share of the allowed cells painted, 1 fills them all
+    float density;
+} brush_t;
+
+// Disc of cells within radius of (x, y)
+void sim_paint_circle(sand_simulation *sim, int x, int y, int radius, brush_t brush);
+
+// Stroke of the disc from (x0, y0) to (x1, y1)
+void sim_paint_line(sand_simulation *sim, int x0, int y0, int x1, int y1, int radius, brush_t brush);
+
+void sim_paint_rect(sand_simulation *sim, rect_t r, brush_t brush);
+
+#endif
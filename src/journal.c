@@ -0,0 +1,549 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "snapshot.h"
+#include "rle.h"
+
+/*          File layout                 */
+// A header, then records of a record header and a payload
+// padded to 8 bytes. A tick ends with its delta, then its
+// keyframe if it has one, then the commands run before the
+// next step. A keyframe holds the held brush and a compressed
+// snapshot, a delta one entry per changed chunk.
+#define __journal_magic         "SANDJRNL"
+#define __journal_version       1
+#define __journal_byte_order    0x01020304u
+
+#define __record_keyframe   1
+#define __record_command    2
+#define __record_delta      3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t width;
+    int32_t height;
+    uint32_t keyframe_interval;
+    uint32_t reserved;
+} journal_header;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t tick;
+    // Payload bytes, without the padding
+    uint64_t size;
+} journal_record;
+
+// sim_command as stored, without its padding
+typedef struct {
+    int32_t type;
+    int32_t x;
+    int32_t y;
+    int32_t x1;
+    int32_t y1;
+    int32_t radius;
+    float density;
+    uint8_t id;
+    uint8_t down;
+    uint8_t reserved[2];
+} journal_command;
+
+// Followed by size bytes of run length code
+typedef struct {
+    uint32_t chunk;
+    uint32_t size;
+    uint64_t hash;
+} journal_chunk;
+
+static journal_command store_command(const sim_command *c){
+    journal_command stored = {
+        .type = c->type,
+        .x = c->x,
+        .y = c->y,
+        .x1 = c->x1,
+        .y1 = c->y1,
+        .radius = c->radius,
+        .density = c->brush.density,
+        .id = c->brush.id,
+        .down = c->down != 0
+    };
+    return stored;
+}
+
+static sim_command load_command(const journal_command *stored){
+    sim_command c = {
+        .type = stored->type,
+        .x = stored->x,
+        .y = stored->y,
+        .x1 = stored->x1,
+        .y1 = stored->y1,
+        .radius = stored->radius,
+        .brush = {.id = stored->id, .density = stored->density},
+        .down = stored->down
+    };
+    return c;
+}
+
+/*          Chunk changes               */
+// Cells of a chunk are captured plane after plane in rows of
+// the chunk: ids, variants, velocity and life time. Velocity
+// and life time of empty cells are never read and are taken
+// as 0. Deltas XOR the ids and variants with the ones last
+// recorded and hash all of it, so moving cells cost two bytes
+// and any other change still shows in the hash.
+#define __cell_bytes    (2 + 3 * sizeof(real_t))
+#define __chunk_cells   (chunk_size * chunk_size)
+
+typedef struct {
+    sand_simulation *sim;
+    // Ids and variants of every chunk as last recorded
+    uint8_t *last;
+    uint64_t *hashes;
+    uint8_t *raw;
+    uint8_t *packed;
+
+    // Every chunk is compared on the next delta, a clear
+    // leaves no dirty rectangles behind
+    int all;
+
+    uint8_t *delta;
+    size_t delta_size;
+    size_t delta_capacity;
+} tracker;
+
+// Returns the number of cells
+static int capture_chunk(sand_simulation *sim, int c, uint8_t *out){
+    rect_t r = sim_chunk_cells(sim, c);
+    int w = r.max_x - r.min_x;
+    int cells = w * (r.max_y - r.min_y);
+    uint8_t *ids = out;
+
+    const uint8_t *bytes[2] = {sim->ids, sim->variants};
+    for(int p = 0; p < 2; p++){
+        for(int y = r.min_y; y < r.max_y; y++){
+            memcpy(out, &bytes[p][get_index(sim, r.min_x, y)], w);
+            out += w;
+        }
+    }
+
+    const real_t *reals[3] = {sim->velocity_x, sim->velocity_y, sim->life_time};
+    for(int p = 0; p < 3; p++){
+        for(int y = r.min_y; y < r.max_y; y++){
+            memcpy(out, &reals[p][get_index(sim, r.min_x, y)], w * sizeof(real_t));
+            out += w * sizeof(real_t);
+        }
+        for(int k = 0; k < cells; k++){
+            if(ids[k] == empty_id) memset(out - (cells - k) * sizeof(real_t), 0, sizeof(real_t));
+        }
+    }
+    return cells;
+}
+
+static uint64_t hash_bytes(const uint8_t *data, size_t n){
+    uint64_t h = n;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 29;
+    }
+    for(; i < n; i++){
+        h = (h ^ data[i]) * 0x94D049BB133111EBull;
+    }
+    return rng_mix(h);
+}
+
+static int tracker_init(tracker *t, sand_simulation *sim){
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    memset(t, 0, sizeof(*t));
+    t->sim = sim;
+    t->last = (uint8_t *) malloc(2 * __chunk_cells * chunk_count);
+    t->hashes = (uint64_t *) malloc(sizeof(uint64_t) * chunk_count);
+    t->raw = (uint8_t *) malloc(__cell_bytes * __chunk_cells);
+    t->packed = (uint8_t *) malloc(rle_bound(2 * __chunk_cells));
+    if(!t->last || !t->hashes || !t->raw || !t->packed) return 0;
+
+    for(int c = 0; c < chunk_count; c++){
+        int cells = capture_chunk(sim, c, t->raw);
+        memcpy(&t->last[2 * __chunk_cells * c], t->raw, 2 * cells);
+        t->hashes[c] = hash_bytes(t->raw, cells * __cell_bytes);
+    }
+    return 1;
+}
+
+static void tracker_free(tracker *t){
+    free(t->last);
+    free(t->hashes);
+    free(t->raw);
+    free(t->packed);
+    free(t->delta);
+    memset(t, 0, sizeof(*t));
+}
+
+static void tracker_command(tracker *t, const sim_command *c){
+    if(c->type == command_clear) t->all = 1;
+}
+
+static int append(tracker *t, const void *data, size_t size){
+    if(t->delta_size + size > t->delta_capacity){
+        size_t capacity = t->delta_capacity ? t->delta_capacity * 2 : 4096;
+        while(capacity < t->delta_size + size) capacity *= 2;
+        uint8_t *delta = (uint8_t *) realloc(t->delta, capacity);
+        if(!delta) return 0;
+        t->delta = delta;
+        t->delta_capacity = capacity;
+    }
+    memcpy(&t->delta[t->delta_size], data, size);
+    t->delta_size += size;
+    return 1;
+}
+
+// Cells written through p_set leave their chunk dirty after
+// the step, burning cells also age in place without waking
+static int chunk_touched(sand_simulation *sim, int c){
+    rect_t dirty = sim->chunks[c].dirty;
+    return dirty.min_x < dirty.max_x || sim_class_any(sim, class_burning, sim_chunk_cells(sim, c));
+}
+
+// Changes since the last delta, into t->delta
+static int take_delta(tracker *t){
+    sand_simulation *sim = t->sim;
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    t->delta_size = 0;
+
+    for(int c = 0; c < chunk_count; c++){
+        if(!t->all && !chunk_touched(sim, c)) continue;
+
+        int cells = capture_chunk(sim, c, t->raw);
+        uint64_t hash = hash_bytes(t->raw, cells * __cell_bytes);
+        if(hash == t->hashes[c]) continue;
+        t->hashes[c] = hash;
+
+        uint8_t *last = &t->last[2 * __chunk_cells * c];
+        for(int i = 0; i < 2 * cells; i++){
+            uint8_t now = t->raw[i];
+            t->raw[i] ^= last[i];
+            last[i] = now;
+        }
+        journal_chunk entry = {.chunk = c, .size = rle_pack(t->raw, 2 * cells, t->packed), .hash = hash};
+        if(!append(t, &entry, sizeof(entry)) || !append(t, t->packed, entry.size)) return 0;
+    }
+    t->all = 0;
+    return 1;
+}
+
+/*          Recording                   */
+struct sim_journal {
+    FILE *file;
+    sand_simulation *sim;
+    int keyframe_interval;
+    uint64_t tick;
+    uint64_t size;
+    int failed;
+    tracker changes;
+};
+
+static void put(sim_journal *j, const void *data, size_t size){
+    if(!j->failed && fwrite(data, 1, size, j->file) != size) j->failed = 1;
+    j->size += size;
+}
+
+static void pad(sim_journal *j){
+    static const uint8_t zeros[8] = {0};
+    put(j, zeros, (8 - j->size % 8) % 8);
+}
+
+static void put_record(sim_journal *j, uint32_t type, const void *payload, size_t size){
+    journal_record record = {.type = type, .tick = j->tick, .size = size};
+    put(j, &record, sizeof(record));
+    put(j, payload, size);
+    pad(j);
+}
+
+// The snapshot size is only known once written, the record
+// header is patched afterwards
+static void put_keyframe(sim_journal *j, const sim_input *input){
+    off_t at = (off_t) j->size;
+    journal_record record = {.type = __record_keyframe, .tick = j->tick};
+    journal_command brush = store_command(&input->brush);
+    put(j, &record, sizeof(record));
+    put(j, &brush, sizeof(brush));
+    if(j->failed || !sim_write_snapshot(j->sim, j->file, snapshot_compressed)){
+        j->failed = 1;
+        return;
+    }
+
+    off_t end = ftello(j->file);
+    record.size = end - at - sizeof(record);
+    j->size = end;
+    if(fseeko(j->file, at, SEEK_SET) || fwrite(&record, sizeof(record), 1, j->file) != 1
+        || fseeko(j->file, end, SEEK_SET)){
+        j->failed = 1;
+        return;
+    }
+    pad(j);
+
+    // A journal cut short by a crash replays up to here
+    if(fflush(j->file)) j->failed = 1;
+}
+
+sim_journal *sim_journal_create(sand_simulation *sim, const char *path, int keyframe_interval){
+    if(keyframe_interval < 1) return NULL;
+
+    sim_journal *j = (sim_journal *) calloc(1, sizeof(sim_journal));
+    if(!j) return NULL;
+    j->sim = sim;
+    j->keyframe_interval = keyframe_interval;
+    j->file = fopen(path, "wb");
+    if(!j->file || !tracker_init(&j->changes, sim)){
+        sim_journal_close(j);
+        return NULL;
+    }
+
+    journal_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, __journal_magic, sizeof(h.magic));
+    h.version = __journal_version;
+    h.byte_order = __journal_byte_order;
+    h.width = sim->width;
+    h.height = sim->height;
+    h.keyframe_interval = keyframe_interval;
+    put(j, &h, sizeof(h));
+
+    sim_input input;
+    memset(&input, 0, sizeof(input));
+    put_keyframe(j, &input);
+    if(j->failed){
+        sim_journal_close(j);
+        return NULL;
+    }
+    return j;
+}
+
+int sim_journal_close(sim_journal *j){
+    if(!j) return 0;
+
+    int ok = !j->failed;
+    if(j->file && fclose(j->file)) ok = 0;
+    tracker_free(&j->changes);
+    free(j);
+    return ok;
+}
+
+void sim_journal_command(sim_journal *j, const sim_command *c){
+    journal_command stored = store_command(c);
+    tracker_command(&j->changes, c);
+    put_record(j, __record_command, &stored, sizeof(stored));
+}
+
+void sim_journal_tick(sim_journal *j, const sim_input *input){
+    j->tick++;
+    if(!take_delta(&j->changes)) j->failed = 1;
+    put_record(j, __record_delta, j->changes.delta, j->changes.delta_size);
+    if(j->tick % j->keyframe_interval == 0) put_keyframe(j, input);
+}
+
+uint64_t sim_journal_size(sim_journal *j){
+    return j->size;
+}
+
+/*          Replay                      */
+struct sim_replay {
+    uint8_t *file;
+    size_t size;
+    int threads;
+
+    // Offsets of the keyframe records, in tick order
+    uint64_t *keyframes;
+    int keyframe_count;
+    uint64_t last_tick;
+
+    sand_simulation *sim;
+    sim_input input;
+    uint64_t tick;
+    uint64_t diverged;
+    tracker changes;
+    // Offset of the next record to run
+    uint64_t cursor;
+};
+
+// Record at offset at, NULL past the end or if cut off
+static const journal_record *record_at(sim_replay *r, uint64_t at){
+    if(at > r->size || r->size - at < sizeof(journal_record)) return NULL;
+    const journal_record *record = (const journal_record *) (r->file + at);
+    if(record->size > r->size - at - sizeof(*record)) return NULL;
+    return record;
+}
+
+static uint64_t next_record(uint64_t at, const journal_record *record){
+    return at + sizeof(*record) + (record->size + 7) / 8 * 8;
+}
+
+sim_replay *sim_replay_open(const char *path, int threads){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size < (off_t) sizeof(journal_header)){
+        close(fd);
+        return NULL;
+    }
+    sim_replay *r = (sim_replay *) calloc(1, sizeof(sim_replay));
+    if(!r){
+        close(fd);
+        return NULL;
+    }
+    r->size = st.st_size;
+    r->threads = threads;
+    r->file = (uint8_t *) mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(r->file == MAP_FAILED){
+        free(r);
+        return NULL;
+    }
+
+    const journal_header *h = (const journal_header *) r->file;
+    if(memcmp(h->magic, __journal_magic, sizeof(h->magic)) || h->version != __journal_version
+        || h->byte_order != __journal_byte_order){
+        sim_replay_close(r);
+        return NULL;
+    }
+
+    int capacity = 0;
+    const journal_record *record;
+    for(uint64_t at = sizeof(*h); (record = record_at(r, at)); at = next_record(at, record)){
+        if(record->type == __record_delta && record->tick > r->last_tick){
+            r->last_tick = record->tick;
+        }
+        if(record->type != __record_keyframe) continue;
+
+        if(r->keyframe_count == capacity){
+            capacity = capacity ? capacity * 2 : 64;
+            uint64_t *keyframes = (uint64_t *) realloc(r->keyframes, sizeof(uint64_t) * capacity);
+            if(!keyframes){
+                sim_replay_close(r);
+                return NULL;
+            }
+            r->keyframes = keyframes;
+        }
+        r->keyframes[r->keyframe_count++] = at;
+    }
+
+    if(!r->keyframe_count){
+        sim_replay_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+void sim_replay_close(sim_replay *r){
+    if(!r) return;
+
+    sim_destroy(r->sim);
+    tracker_free(&r->changes);
+    free(r->keyframes);
+    if(r->file && r->file != MAP_FAILED) munmap(r->file, r->size);
+    free(r);
+}
+
+uint64_t sim_replay_last_tick(sim_replay *r){
+    return r->last_tick;
+}
+
+int sim_replay_keyframes(sim_replay *r){
+    return r->keyframe_count;
+}
+
+sand_simulation *sim_replay_world(sim_replay *r){
+    return r->sim;
+}
+
+uint64_t sim_replay_tick(sim_replay *r){
+    return r->tick;
+}
+
+uint64_t sim_replay_diverged(sim_replay *r){
+    return r->diverged;
+}
+
+static int restore_keyframe(sim_replay *r, int k){
+    const journal_record *record = record_at(r, r->keyframes[k]);
+    if(record->size < sizeof(journal_command)) return 0;
+
+    const uint8_t *payload = (const uint8_t *) (record + 1);
+    sand_simulation *sim = sim_read_snapshot(payload + sizeof(journal_command), record->size - sizeof(journal_command));
+    if(!sim) return 0;
+
+    tracker changes;
+    if(!tracker_init(&changes, sim)){
+        tracker_free(&changes);
+        sim_destroy(sim);
+        return 0;
+    }
+    sim_set_threads(sim, r->threads);
+
+    sim_destroy(r->sim);
+    tracker_free(&r->changes);
+    r->sim = sim;
+    r->changes = changes;
+    r->input.brush = load_command((const journal_command *) payload);
+    r->input.moved = 0;
+    r->tick = record->tick;
+    r->diverged = 0;
+    r->cursor = next_record(r->keyframes[k], record);
+    return 1;
+}
+
+int sim_replay_seek(sim_replay *r, uint64_t tick){
+    if(tick > r->last_tick) return 0;
+
+    int k = r->keyframe_count - 1;
+    while(k > 0 && record_at(r, r->keyframes[k])->tick > tick) k--;
+    uint64_t keyframe_tick = record_at(r, r->keyframes[k])->tick;
+    if(keyframe_tick > tick) return 0;
+
+    if(!r->sim || r->tick > tick || r->tick < keyframe_tick){
+        if(!restore_keyframe(r, k)) return 0;
+    }
+    while(r->tick < tick){
+        if(!sim_replay_step(r)) return 0;
+    }
+    return 1;
+}
+
+int sim_replay_step(sim_replay *r){
+    if(!r->sim) return 0;
+
+    const journal_record *record;
+    while((record = record_at(r, r->cursor)) && record->tick == r->tick){
+        if(record->type == __record_command){
+            if(record->size != sizeof(journal_command)) return 0;
+            sim_command c = load_command((const journal_command *) (record + 1));
+            tracker_command(&r->changes, &c);
+            sim_input_run(&r->input, r->sim, &c);
+        }else if(record->type != __record_keyframe){
+            break;
+        }
+        r->cursor = next_record(r->cursor, record);
+    }
+
+    // The tick ends with its delta
+    if(!record || record->type != __record_delta || record->tick != r->tick + 1) return 0;
+
+    sim_input_step(&r->input, r->sim);
+    r->tick++;
+    r->cursor = next_record(r->cursor, record);
+
+    int same = take_delta(&r->changes) && r->changes.delta_size == record->size
+        && !memcmp(r->changes.delta, record + 1, record->size);
+    if(!same && !r->diverged) r->diverged = r->tick;
+    return 1;
+}
@@ -0,0 +1,67 @@
+#ifndef __JOURNALH__
+#define __JOURNALH__
+
+#include <stdint.h>
+#include "particle.h"
+#include "sim_thread.h"
+
+// Records a world tick by tick in one file: a keyframe every
+// keyframe_interval ticks, the commands run before each tick
+// and, after it, the chunks that changed. A changed chunk is
+// stored as the XOR of its ids and variants with the ones
+// last recorded, run length coded, and a hash of all its
+// cells, so cells that stayed put cost next to nothing. A
+// step only depends on the world and the commands before it,
+// so a replay restores the keyframe at or before a tick and
+// steps on from there, checking every tick against the
+// recorded changes.
+
+#define journal_default_keyframe_interval 600
+
+// Starts with a keyframe of the world as it is now, brush
+// up. Returns NULL if the file can't be written.
+sim_journal *sim_journal_create(sand_simulation *sim, const char *path, int keyframe_interval);
+
+// Returns 0 if a record couldn't be written
+int sim_journal_close(sim_journal *j);
+
+// Called on the thread stepping the world, for every command
+// right before it runs and once after every step
+void sim_journal_command(sim_journal *j, const sim_command *c);
+void sim_journal_tick(sim_journal *j, const sim_input *input);
+
+// Bytes written so far
+uint64_t sim_journal_size(sim_journal *j);
+
+typedef struct sim_replay sim_replay;
+
+// Worlds restored from keyframes step on threads threads.
+// Returns NULL if the file isn't a journal. A journal still
+// being written is read up to its last whole record.
+sim_replay *sim_replay_open(const char *path, int threads);
+void sim_replay_close(sim_replay *r);
+
+uint64_t sim_replay_last_tick(sim_replay *r);
+int sim_replay_keyframes(sim_replay *r);
+
+// Restores the last keyframe at or before tick, unless the
+// world is already between it and tick, and steps up to tick.
+// Returns 0 if tick wasn't recorded or the keyframe can't be
+// read.
+int sim_replay_seek(sim_replay *r, uint64_t tick);
+
+// Runs the recorded commands of the next tick and steps the
+// world. Returns 0 at the end of the journal.
+int sim_replay_step(sim_replay *r);
+
+// The replayed world, NULL before the first seek, and the
+// tick it is at. The world is replaced when a seek restores
+// a keyframe.
+sand_simulation *sim_replay_world(sim_replay *r);
+uint64_t sim_replay_tick(sim_replay *r);
+
+// First tick since the last restored keyframe whose changes
+// differ from the recorded ones, 0 while the replay matches
+uint64_t sim_replay_diverged(sim_replay *r);
+
+#endif
@@ -1,9 +1,15 @@
+#define GL_GLEXT_PROTOTYPES
+#define GLFW_INCLUDE_GLEXT
 #include <GLFW/glfw3.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include "particle.h"
+#include "sim_thread.h"
+#include "snapshot.h"
+#include "journal.h"
 
 int window_width = 800;
 int window_height = 600;
@@ -11,6 +17,20 @@ int window_height = 600;
 GLFWwindow *window;
 GLuint texId;
 
+// The world shown in the window, stepped by runner. Only
+// its size is read here while the runner is going.
+sand_simulation *simulation;
+sim_thread *runner;
+
+// Last brush sent to the runner
+sim_command sent_brush;
+
+// Two pixel buffers used in turns, so filling one does not
+// wait on the transfer of the other. Each is allocated once
+// and laid out like a whole frame.
+GLuint pboIds[2];
+int pbo_index = 0;
+
 double cursor_x;
 double cursor_y;
 
@@ -26,7 +46,7 @@ void window_size_callback(GLFWwindow *window, int width, int height);
 void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos);
 void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
-void throw_particles();
+void send_brush();
 
 int setup_window(){
     if(!glfwInit()) return -1;
@@ -38,6 +58,7 @@ int setup_window(){
     }
 
     glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
 
     glfwSetWindowSizeCallback(window, window_size_callback);
     glfwSetCursorPosCallback(window, cursor_pos_callback);
@@ -55,12 +76,65 @@ void setupGL(){
     glClear(GL_COLOR_BUFFER_BIT);
 
     glGenTextures(1, &texId);
+    glBindTexture(GL_TEXTURE_2D, texId);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+    // Storage is allocated once, frames only upload what changed
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        simulation->width,
+        simulation->height,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        NULL
+    );
+
+    // Uploads read rows of the whole world out of the buffers
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, simulation->width);
+    glGenBuffers(2, pboIds);
+    for(int i = 0; i < 2; i++){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboIds[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, simulation->width * simulation->height * 4, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Copies what changed in the frame into the next pixel buffer
+// and lets the driver transfer it to the texture asynchronously.
+// Only the range from the first to the last changed pixel is
+// mapped, invalidated so the driver doesn't preserve or wait
+// for what was there.
+void upload_texture(const sim_frame *frame){
+    rect_t r = frame->changed;
+    int w = r.max_x - r.min_x;
+    int h = r.max_y - r.min_y;
+    size_t stride = (size_t) simulation->width * 4;
+    size_t offset = (size_t) get_index(simulation, r.min_x, r.min_y) * 4;
+    size_t length = (h - 1) * stride + w * 4;
+
+    glBindTexture(GL_TEXTURE_2D, texId);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboIds[pbo_index]);
+
+    uint8_t *dst = (uint8_t *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, length,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if(dst){
+        for(int y = 0; y < h; y++){
+            memcpy(dst + y * stride, &frame->pixels[offset + y * stride], w * 4);
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.min_x, r.min_y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, (const void *) offset);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pbo_index = 1 - pbo_index;
 }
 
 void render(GLFWwindow *window){
@@ -69,18 +143,13 @@ void render(GLFWwindow *window){
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glTexImage2D(
-        GL_TEXTURE_2D, 
-        0,
-        GL_RGBA8,
-        simulation->width,
-        simulation->height, 
-        0, 
-        GL_RGBA, 
-        GL_UNSIGNED_BYTE, 
-        simulation->texture_buffer
-    );
+    // Without a new frame the texture still holds the last one
+    const sim_frame *frame = sim_thread_frame(runner);
+    if(frame && frame->changed.min_x < frame->changed.max_x){
+        upload_texture(frame);
+    }
 
+    glBindTexture(GL_TEXTURE_2D, texId);
     glEnable(GL_TEXTURE_2D);
     glBegin(GL_QUADS);
         glTexCoord2f(0, 0);
@@ -112,42 +181,90 @@ void render(GLFWwindow *window){
     glfwSwapBuffers(window);
 }
 
-int main(){
+// Puts the tick and frame rates of the last period in the
+// title, dropped ticks show the world running slow
+void show_stats(double period){
+    static sim_thread_stats last;
+    sim_thread_stats now = sim_thread_get_stats(runner);
+
+    char title[128];
+    snprintf(title, sizeof(title), "Sand Simulation - %.0f ticks/s, %.0f frames/s, %llu skipped, %llu dropped",
+        (now.ticks - last.ticks) / period,
+        (now.frames - last.frames) / period,
+        now.skipped_frames - last.skipped_frames,
+        now.dropped_ticks - last.dropped_ticks);
+    glfwSetWindowTitle(window, title);
+    last = now;
+}
+
+// Usage: sand-sim [snapshot] [journal]
+// The world is loaded from the snapshot if it can be read
+// and saved back to it on exit, - skips it. Every tick is
+// recorded to the journal if one is given.
+int main(int argc, char **argv){
+    const char *snapshot = argc > 1 && strcmp(argv[1], "-") ? argv[1] : NULL;
+    const char *journal_path = argc > 2 ? argv[2] : NULL;
+
     if(!setup_window()){
         glfwTerminate();
         return -1;
     }
 
-    srand(time(NULL));
-    init_simulation(512, 512);
+    simulation = snapshot ? sim_load(snapshot) : NULL;
+    if(!simulation){
+        simulation = sim_create(512, 512);
+        if(!simulation){
+            fprintf(stderr, "could not allocate the simulation\n");
+            glfwTerminate();
+            return -1;
+        }
+        sim_seed(simulation, time(NULL));
+    }
+    sim_set_threads(simulation, cpu_count());
     setupGL();
 
-    double limit_fps = 1.0/60.0;
-    double last_time = glfwGetTime();
-    double reset_rand_seed = glfwGetTime();
-
-    while(!glfwWindowShouldClose(window)){
-        double now = glfwGetTime();
-        if(now - last_time > 1.0/60.0){
-            if(pressed_left_btn){
-                throw_particles();
-            }
+    sim_schedule schedule = {
+        .tick_rate = sim_default_tick_rate,
+        .max_substeps = sim_default_max_substeps,
+        .frame_budget = sim_default_frame_budget
+    };
+    sim_journal *journal = NULL;
+    if(journal_path){
+        journal = sim_journal_create(simulation, journal_path, journal_default_keyframe_interval);
+        if(!journal) fprintf(stderr, "could not write the journal %s\n", journal_path);
+    }
 
-            update_simulation();
-            last_time = glfwGetTime();
-        }
-     
-        if(glfwGetTime() - reset_rand_seed > 300){
-            srand(time(NULL));
-            reset_rand_seed = glfwGetTime();
-        }
+    runner = sim_thread_start_journal(simulation, schedule, journal);
+    if(!runner){
+        fprintf(stderr, "could not start the simulation thread\n");
+        if(journal) sim_journal_close(journal);
+        sim_destroy(simulation);
+        glfwTerminate();
+        return -1;
+    }
 
+    // The world steps on its own thread, this one only
+    // forwards input and draws the latest frame
+    double last_title = glfwGetTime();
+    while(!glfwWindowShouldClose(window)){
+        glfwPollEvents();
+        send_brush();
         render(window);
 
-        glfwPollEvents();
+        if(glfwGetTime() - last_title >= 1.0){
+            show_stats(glfwGetTime() - last_title);
+            last_title = glfwGetTime();
+        }
     }
 
-    destroy_simulation();
+    sim_thread_stop(runner);
+    if(journal && !sim_journal_close(journal)){
+        fprintf(stderr, "could not finish the journal %s\n", journal_path);
+    }
+    if(snapshot && !sim_save(simulation, snapshot, 0)){
+        fprintf(stderr, "could not save the world to %s\n", snapshot);
+    }
+    sim_destroy(simulation);
     glfwTerminate();    
     return 0;
 }
@@ -158,11 +275,10 @@ void window_size_callback(GLFWwindow *window, int width, int height){
     window_width = width;
     window_height = height;
     glViewport(0, 0, width, height);
-    render(window);
-    
+
+    // The main loop draws the next frame at the new size
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    render(window);
 }
 
 void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos){
@@ -220,7 +336,10 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
                 selected_particle = fire_id;
         break;
         case GLFW_KEY_BACKSPACE:
-            clear_particles();
+            if(action == GLFW_PRESS){
+                sim_command c = {.type = command_clear};
+                sim_thread_send(runner, c);
+            }
         break;
         case GLFW_KEY_ESCAPE:
             if(action == GLFW_PRESS){
@@ -230,45 +349,36 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     }
 }
 
-void throw_particles(){
+// Sends the brush under the cursor when it changed, the
+// runner paints with it every tick while a button is down.
+// The left button sprinkles the selected particle over a
+// share of the disc, the right one erases it.
+#define __brush_density 0.025
+
+void send_brush(){
     double xpos = world_x + 1;
     double ypos = world_y + 1; 
 
-    int x = round(xpos*simulation->width/2.0);
-    int y = round(ypos*simulation->height/2.0);
-
-    int rx = round(cursor_r*simulation->width/2.0);
-    int ry = round(cursor_r*simulation->height/2.0);
-
-    for(int k = 0; k < 50; k++){
-        int angle = rand() % 360;
-        float m = ((float)rand())/((float)RAND_MAX);
-        int i = round(sin( 3.1415926 *angle/180.0)*rx*m) + x;
-        int j = round(cos( 3.1415926 *angle/180.0)*ry*m) + y;
-        
-        int index = get_index(i, j);
-        switch(selected_particle){
-            case sand_id:
-                if(in_bounds(i, j) && simulation->particles[index].id == empty_id)
-                    simulation->particles[index] = new_sand();
-            break;
-            case water_id:
-                if(in_bounds(i, j) && simulation->particles[index].id == empty_id)
-                    simulation->particles[index] = new_water();
-            break;
-            case coal_id:
-                if(in_bounds(i, j) && simulation->particles[index].id == empty_id)
-                    simulation->particles[index] = new_coal();
-            break;
-            case fire_id:
-                if(in_bounds(i, j) && (simulation->particles[index].id == empty_id || simulation->particles[index].id == coal_id || simulation->particles[index].id == oil_id))
-                    simulation->particles[index] = new_fire();    
-            break;
-            case oil_id:
-                if(in_bounds(i, j) && simulation->particles[index].id == empty_id)
-                    simulation->particles[index] = new_oil();
-            break;
-        }
+    brush_t brush = {.id = selected_particle, .density = __brush_density};
+    if(pressed_right_btn){
+        brush.id = empty_id;
+        brush.density = 1.0;
     }
 
-}
\ No newline at end of file
+    sim_command c = {
+        .type = command_brush,
+        .x = round(xpos*simulation->width/2.0),
+        .y = round(ypos*simulation->height/2.0),
+        .radius = round(cursor_r*simulation->width/2.0),
+        .brush = brush,
+        .down = pressed_left_btn || pressed_right_btn
+    };
+
+    int same = c.x == sent_brush.x && c.y == sent_brush.y
+        && c.radius == sent_brush.radius && c.brush.id == sent_brush.brush.id
+        && c.brush.density == sent_brush.brush.density && c.down == sent_brush.down;
+
+    if(!same && sim_thread_send(runner, c)){
+        sent_brush = c;
+    }
+}
@@ -1,86 +1,855 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
 #include "particle.h"
+#include "row_scan.h"
+
+_Static_assert(2 * __max_reach < chunk_size, "parallel chunks could touch the same cells");
+
+/*          Material registry           */
+const material_t materials[material_count] = {
+    [empty_id] = {
+        .name = "empty",
+        .density = 0.0,
+        .flags = material_displaceable,
+        .update = NULL
+    },
+    [sand_id] = {
+        .name = "sand",
+        .density = 1.6,
+        .flags = material_powder | material_sleeps,
+        .update = update_sand
+    },
+    [water_id] = {
+        .name = "water",
+        .density = 1.0,
+        .flags = material_liquid,
+        .update = update_water
+    },
+    [coal_id] = {
+        .name = "coal",
+        .density = 1.4,
+        .flags = material_powder | material_flammable | material_sleeps,
+        .update = update_coal
+    },
+    [oil_id] = {
+        .name = "oil",
+        .density = 0.9,
+        .flags = material_liquid | material_flammable,
+        .update = update_oil
+    },
+    [fire_id] = {
+        .name = "fire",
+        .density = 0.2,
+        .flags = material_burning,
+        .update = update_fire
+    },
+    [smoke_id] = {
+        .name = "smoke",
+        .density = 0.1,
+        .flags = material_displaceable | material_gas,
+        .update = update_smoke
+    },
+    [steam_id] = {
+        .name = "steam",
+        .density = 0.1,
+        .flags = material_displaceable | material_gas,
+        .update = update_steam
+    }
+};
+
+/*          Particle colors             */
+// Colors are packed as 0xAABBGGRR so they can be written
+// to the texture buffer in one store. The variant byte is
+// multiplied into the channels set in material_variant_channels,
+// coal stores its gray level and fire its green channel there.
+static const uint32_t material_colors[material_count] = {
+    [empty_id] = 0xFFFFC850,
+    [sand_id]  = 0xFF32CDE6,
+    [water_id] = 0xFFAA7832,
+    [coal_id]  = 0xFF000000,
+    [oil_id]   = 0xFF698282,
+    [fire_id]  = 0xFF3200E6,
+    [smoke_id] = 0xFF464646,
+    [steam_id] = 0xFFD7D7D7
+};
+
+static const uint32_t material_variant_channels[material_count] = {
+    [coal_id] = 0x00010101,
+    [fire_id] = 0x00000100
+};
+
+static inline uint32_t packed_color(uint8_t id, uint8_t variant){
+    return material_colors[id] | variant * material_variant_channels[id];
+}
+
+color_t particle_color(uint8_t id, uint8_t variant){
+    uint32_t rgba = packed_color(id, variant);
+    color_t c = {
+        .r = rgba & 0xFF,
+        .g = (rgba >> 8) & 0xFF,
+        .b = (rgba >> 16) & 0xFF,
+        .a = rgba >> 24
+    };
+    return c;
+}
+
+/*          Dirty chunks                */
+static inline rect_t empty_rect(){
+    rect_t r = {.min_x = INT_MAX, .min_y = INT_MAX, .max_x = INT_MIN, .max_y = INT_MIN};
+    return r;
+}
+
+static inline void grow_rect(rect_t *r, int min_x, int min_y, int max_x, int max_y){
+    if(min_x < r->min_x) r->min_x = min_x;
+    if(min_y < r->min_y) r->min_y = min_y;
+    if(max_x > r->max_x) r->max_x = max_x;
+    if(max_y > r->max_y) r->max_y = max_y;
+}
+
+static inline rect_t chunk_rect(sand_simulation *sim, int cx, int cy){
+    rect_t r = {
+        .min_x = cx * chunk_size,
+        .min_y = cy * chunk_size,
+        .max_x = (cx + 1) * chunk_size < sim->width ? (cx + 1) * chunk_size : sim->width,
+        .max_y = (cy + 1) * chunk_size < sim->height ? (cy + 1) * chunk_size : sim->height
+    };
+    return r;
+}
+
+// Marks the 3x3 block around (x, y) to be updated, which
+// may spill into the neighbouring chunks. Cells that are
+// still ahead of the sweep get updated this tick too, so
+// a falling column moves all at once like in a full sweep.
+// If paint is set the cell itself is also queued for
+// sim_compose_texture. Sleeping cells in the block wake up.
+static void wake_area(sand_simulation *sim, int x, int y, int paint){
+    int min_x = x > 0 ? x - 1 : 0;
+    int min_y = y > 0 ? y - 1 : 0;
+    int max_x = x + 1 < sim->width ? x + 2 : sim->width;
+    int max_y = y + 1 < sim->height ? y + 2 : sim->height;
+
+    for(int wy = min_y; wy < max_y; wy++){
+        memset(&sim->idle_ticks[wy * sim->width + min_x], 0, max_x - min_x);
+    }
+
+    for(int cy = min_y / chunk_size; cy <= (max_y - 1) / chunk_size; cy++){
+        for(int cx = min_x / chunk_size; cx <= (max_x - 1) / chunk_size; cx++){
+            sim_chunk *chunk = &sim->chunks[cy * sim->chunks_x + cx];
+            rect_t r = chunk_rect(sim, cx, cy);
+
+            if(min_x > r.min_x) r.min_x = min_x;
+            if(min_y > r.min_y) r.min_y = min_y;
+            if(max_x < r.max_x) r.max_x = max_x;
+            if(max_y < r.max_y) r.max_y = max_y;
+
+            // Chunks between two that are updated in parallel
+            // can be woken from both threads
+            if(sim->pool){
+                while(atomic_flag_test_and_set_explicit(&chunk->lock, memory_order_acquire));
+            }
+            grow_rect(&chunk->dirty, r.min_x, r.min_y, r.max_x, r.max_y);
+            grow_rect(&chunk->next_dirty, r.min_x, r.min_y, r.max_x, r.max_y);
+            if(paint && x / chunk_size == cx && y / chunk_size == cy){
+                grow_rect(&chunk->paint, x, y, x + 1, y + 1);
+            }
+            if(sim->pool){
+                atomic_flag_clear_explicit(&chunk->lock, memory_order_release);
+            }
+        }
+    }
+}
+
+void wake_cell(sand_simulation *sim, int x, int y){
+    wake_area(sim, x, y, 0);
+}
+
+rect_t sim_chunk_cells(sand_simulation *sim, int c){
+    return chunk_rect(sim, c % sim->chunks_x, c / sim->chunks_x);
+}
+
+/*          Surface index               */
+// Flips a bit known to change. Words are only shared
+// between tasks of a thread pool, a lone thread skips
+// the locked instruction.
+static inline void flip_bit(sand_simulation *sim, _Atomic uint64_t *word, uint64_t bit){
+    if(sim->pool){
+        atomic_fetch_xor_explicit(word, bit, memory_order_relaxed);
+    }else{
+        uint64_t old = atomic_load_explicit(word, memory_order_relaxed);
+        atomic_store_explicit(word, old ^ bit, memory_order_relaxed);
+    }
+}
+
+// Called by p_set when a cell turns empty or stops being
+// empty. The bits are read by the kernels, so they are kept
+// up to date, while the column bounds are only marked stale
+// and rebuilt by the next query. Words are shared by the
+// chunks of a phase, the stale flag is only written once.
+static inline void flip_surface(sand_simulation *sim, int x, int y){
+    flip_bit(sim, &sim->occupied[y * sim->row_words + (x >> 6)], (uint64_t) 1 << (x & 63));
+    if(!atomic_load_explicit(&sim->columns_stale, memory_order_relaxed)){
+        atomic_store_explicit(&sim->columns_stale, 1, memory_order_relaxed);
+    }
+}
+
+static void find_column_bounds(sand_simulation *sim, int top);
+
+static inline void settle_columns(sand_simulation *sim){
+    if(atomic_load_explicit(&sim->columns_stale, memory_order_relaxed)){
+        find_column_bounds(sim, 1);
+        find_column_bounds(sim, 0);
+        atomic_store_explicit(&sim->columns_stale, 0, memory_order_relaxed);
+    }
+}
+
+// One past the highest non empty cell, 0 for an empty column
+int sim_column_top(sand_simulation *sim, int x){
+    settle_columns(sim);
+    return sim->column_top[x];
+}
+
+// Lowest empty cell, height for a full column
+int sim_column_first_empty(sand_simulation *sim, int x){
+    settle_columns(sim);
+    return sim->column_empty[x];
+}
+
+// Set bits of a mask row in [x0, x1), if any is set
+// it stops at the first word with one
+static inline int row_bits(const _Atomic uint64_t *row, int x0, int x1, int any){
+    int count = 0;
+    while(x0 < x1){
+        int w = x0 >> 6;
+        int end = (w + 1) * 64 < x1 ? (w + 1) * 64 : x1;
+        int n = end - x0;
+        uint64_t mask = (n == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1) << (x0 & 63);
+        uint64_t bits = atomic_load_explicit(&row[w], memory_order_relaxed) & mask;
+        if(bits){
+            if(any) return 1;
+            count += __builtin_popcountll(bits);
+        }
+        x0 = end;
+    }
+    return count;
+}
+
+// 1 if every cell of row y in [x0, x1) is empty
+int sim_row_clear(sand_simulation *sim, int y, int x0, int x1){
+    if(x0 < 0) x0 = 0;
+    if(x1 > sim->width) x1 = sim->width;
+    return !row_bits(&sim->occupied[y * sim->row_words], x0, x1, 1);
+}
+
+/*          Class masks                 */
+static const uint8_t class_flags[class_count] = {
+    [class_displaceable] = material_displaceable,
+    [class_powder] = material_powder,
+    [class_liquid] = material_liquid,
+    [class_flammable] = material_flammable,
+    [class_burning] = material_burning
+};
+
+#define __class_flags (material_displaceable | material_powder | material_liquid \
+    | material_flammable | material_burning)
+
+// Called by p_set when the id of a cell changes, only the
+// classes the two materials disagree on flip. Like the
+// occupancy bits, a word can be shared by two chunk tasks.
+static inline void update_classes(sand_simulation *sim, int i, uint8_t from, uint8_t to){
+    uint8_t diff = (materials[from].flags ^ materials[to].flags) & __class_flags;
+    if(!diff) return;
+
+    int x = i % sim->width;
+    int w = (i / sim->width) * sim->row_words + (x >> 6);
+    uint64_t bit = (uint64_t) 1 << (x & 63);
+    for(int c = 0; c < class_count; c++){
+        if(diff & class_flags[c]){
+            flip_bit(sim, &sim->class_masks[c][w], bit);
+        }
+    }
+}
+
+static inline int class_bits(sand_simulation *sim, int class_id, rect_t r, int any){
+    if(r.min_x < 0) r.min_x = 0;
+    if(r.min_y < 0) r.min_y = 0;
+    if(r.max_x > sim->width) r.max_x = sim->width;
+    if(r.max_y > sim->height) r.max_y = sim->height;
+
+    int count = 0;
+    for(int y = r.min_y; y < r.max_y; y++){
+        int bits = row_bits(&sim->class_masks[class_id][y * sim->row_words], r.min_x, r.max_x, any);
+        if(bits && any) return 1;
+        count += bits;
+    }
+    return count;
+}
+
+// 1 if a cell of the class lies in r, a chunk
+// is answered from one word per row
+int sim_class_any(sand_simulation *sim, int class_id, rect_t r){
+    return class_bits(sim, class_id, r, 1);
+}
+
+// Cells of the class in r
+int sim_class_count(sand_simulation *sim, int class_id, rect_t r){
+    return class_bits(sim, class_id, r, 0);
+}
+
+/*          Fire list                   */
+static void list_fire(sand_simulation *sim, int i){
+    if(sim->fire_count == sim->fire_capacity){
+        int capacity = sim->fire_capacity ? sim->fire_capacity * 2 : 256;
+        int *fires = (int *) realloc(sim->fires, sizeof(int) * capacity);
+        if(!fires){
+            sim->fires_lost = 1;
+            return;
+        }
+        sim->fires = fires;
+        sim->fire_capacity = capacity;
+    }
+    sim->fires[sim->fire_count++] = i;
+}
+
+// Lists every burning cell again in index order
+static void rebuild_fires(sand_simulation *sim){
+    sim->fire_count = 0;
+    sim->fires_lost = 0;
+    for(int y = 0; y < sim->height; y++){
+        const _Atomic uint64_t *row = &sim->class_masks[class_burning][y * sim->row_words];
+        for(int w = 0; w < sim->row_words; w++){
+            uint64_t bits = atomic_load_explicit(&row[w], memory_order_relaxed);
+            while(bits){
+                list_fire(sim, y * sim->width + w * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+// Returns NULL if any of the planes can't be allocated.
+// Without planes the cell planes are left to the caller.
+static sand_simulation *create_world(int width, int height, int planes){
+    if(width <= 0 || height <= 0) return NULL;
+
+    sand_simulation *sim = (sand_simulation *) calloc(1, sizeof(sand_simulation));
+    if(!sim) return NULL;
+
+    int n = width * height;
+    int chunks_x = (width + chunk_size - 1) / chunk_size;
+    int chunks_y = (height + chunk_size - 1) / chunk_size;
+
+    sim->width = width;
+    sim->height = height;
+    sim->chunks_x = chunks_x;
+    sim->chunks_y = chunks_y;
+    if(planes){
+        sim->ids = (uint8_t *) malloc(sizeof(uint8_t) * n);
+        sim->variants = (uint8_t *) malloc(sizeof(uint8_t) * n);
+        sim->updated_tick = (uint8_t *) calloc(n, sizeof(uint8_t));
+        sim->idle_ticks = (uint8_t *) malloc(sizeof(uint8_t) * n);
+        sim->velocity_x = (real_t *) malloc(sizeof(real_t) * n);
+        sim->velocity_y = (real_t *) malloc(sizeof(real_t) * n);
+        sim->life_time = (real_t *) malloc(sizeof(real_t) * n);
+    }
+    sim->texture_buffer = (uint8_t *) malloc(sizeof(uint8_t) * n * 4);
+    sim->chunks = (sim_chunk *) malloc(sizeof(sim_chunk) * chunks_x * chunks_y);
+    sim->chunk_list = (int *) malloc(sizeof(int) * chunks_x * chunks_y);
+    sim->row_words = (width + 63) / 64;
+    sim->occupied = (_Atomic uint64_t *) malloc(sizeof(uint64_t) * sim->row_words * height);
+    sim->column_top = (int *) malloc(sizeof(int) * width);
+    sim->column_empty = (int *) malloc(sizeof(int) * width);
+    sim->column_seen = (uint64_t *) malloc(sizeof(uint64_t) * sim->row_words);
+    sim->class_masks[0] = (_Atomic uint64_t *) malloc(sizeof(uint64_t) * sim->row_words * height * class_count);
+    for(int c = 1; c < class_count; c++){
+        sim->class_masks[c] = sim->class_masks[0] ? sim->class_masks[0] + (size_t) c * sim->row_words * height : NULL;
+    }
+
+    if((planes && (!sim->ids || !sim->variants || !sim->updated_tick || !sim->idle_ticks
+        || !sim->velocity_x || !sim->velocity_y || !sim->life_time))
+        || !sim->texture_buffer || !sim->chunks || !sim->chunk_list
+        || !sim->occupied || !sim->column_top || !sim->column_empty || !sim->column_seen
+        || !sim->class_masks[0]){
+        sim_destroy(sim);
+        return NULL;
+    }
+
+    sim->tick = 0;
+    sim->pool = NULL;
+    atomic_init(&sim->visited_cells, 0);
+    atomic_init(&sim->updated_cells, 0);
+    atomic_init(&sim->columns_stale, 1);
+
+    for(int c = 0; c < chunks_x * chunks_y; c++){
+        sim->chunks[c].dirty = empty_rect();
+        sim->chunks[c].next_dirty = empty_rect();
+        sim->chunks[c].paint = empty_rect();
+        atomic_flag_clear(&sim->chunks[c].lock);
+    }
+
+    sim_seed(sim, 1);
+    if(planes) sim_clear(sim);
+    return sim;
+}
+
+sand_simulation *sim_create(int width, int height){
+    return create_world(width, height, 1);
+}
+
+sand_simulation *sim_create_bare(int width, int height){
+    return create_world(width, height, 0);
+}
+
+void sim_destroy(sand_simulation *sim){
+    if(!sim) return;
+
+    if(sim->release_planes){
+        sim->release_planes(sim->planes_memory, sim->planes_size);
+    }else{
+        free(sim->ids);
+        free(sim->variants);
+        free(sim->updated_tick);
+        free(sim->idle_ticks);
+        free(sim->velocity_x);
+        free(sim->velocity_y);
+        free(sim->life_time);
+    }
+    free(sim->texture_buffer);
+    free(sim->chunks);
+    free(sim->chunk_list);
+    free((void *) sim->occupied);
+    free((void *) sim->class_masks[0]);
+    free(sim->fires);
+    free(sim->column_top);
+    free(sim->column_empty);
+    free(sim->column_seen);
+    thread_pool_destroy(sim->pool);
+    free(sim);
+}
+
+// Ticks a sleeping material has to stay in place before
+// it is skipped. Its kernel only depends on the 3x3 block
+// around it, so it can't move until something there changes.
+#define __sleep_ticks 4
+
+// Runs the kernel of one non empty cell, returns 1 if it ran
+static inline int update_cell(sand_simulation *sim, int x, int y){
+    int i = get_index(sim, x, y);
+    const material_t *m = &materials[sim->ids[i]];
+    if(!m->update || sim->updated_tick[i] == sim->tick) return 0;
+
+    if(m->flags & (material_sleeps | material_burning)){
+        // Burning cells are updated by burn_fires
+        if(m->flags & material_burning) return 0;
+
+        // Any change around the cell resets the count through wake_area
+        if(sim->idle_ticks[i] >= __sleep_ticks) return 0;
+        sim->idle_ticks[i]++;
+    }
+
+    particle_t p = p_get(sim, i);
+    m->update(sim, &p, x, y);
+    return 1;
+}
 
-sand_simulation *simulation;
+// Cells inside the dirty rectangle are visited in the same
+// serpentine order the whole grid used to be swept in.
+// The rectangle is re-read every row since cells woken
+// above the current row are still updated this tick.
+// Runs of empty cells are skipped with find_occupied. The id
+// plane is read again after every kernel, so cells filled
+// ahead of the sweep are still visited.
+static void update_chunk(void *arg, int k){
+    sand_simulation *sim = (sand_simulation *) arg;
+    rect_t *r = &sim->chunks[sim->chunk_list[k]].dirty;
+    unsigned long long visited = 0;
+    unsigned long long updated = 0;
+
+    for(int y = r->min_y; y < r->max_y; y++){
+        const uint8_t *row = &sim->ids[y * sim->width];
+        int min_x = r->min_x;
+        int max_x = r->max_x;
+        visited += max_x - min_x;
+
+        if(y % 2 == 0){
+            for(int x = min_x; x < max_x; x++){
+                if(!row[x] && (x = find_occupied(row, x, max_x)) == max_x) break;
+                updated += update_cell(sim, x, y);
+            }
+        }else{
+            for(int x = max_x - 1; x >= min_x; x--){
+                if(!row[x] && (x = find_occupied_back(row, min_x, x + 1)) < min_x) break;
+                updated += update_cell(sim, x, y);
+            }
+        }
+    }
+
+    atomic_fetch_add_explicit(&sim->visited_cells, visited, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sim->updated_cells, updated, memory_order_relaxed);
+}
+
+// Burning cells are skipped by the sweep and updated here,
+// after every chunk and on the calling thread, from the fire
+// list. A coal seam smouldering for thousands of ticks costs
+// its fire front, not the chunks it lies in. Fires lit here
+// are appended to the list and burn from the next tick.
+static void burn_fires(sand_simulation *sim){
+    if(sim->fires_lost) rebuild_fires(sim);
 
-void init_simulation(int width, int height){
-    simulation = (sand_simulation*) malloc(sizeof(sand_simulation));
-    if(!simulation) return;
+    int count = sim->fire_count;
+    int kept = 0;
+    unsigned long long updated = 0;
 
-    particle_t *p = (particle_t *) malloc(sizeof(particle_t) * width * height);   
-    if(!p) return;
+    for(int k = 0; k < count; k++){
+        int i = sim->fires[k];
+        const material_t *m = &materials[sim->ids[i]];
 
-    uint8_t  *tex = (uint8_t *) malloc(sizeof(uint8_t) * width * height * 4);
-    if(!tex) return;
+        // The cell burnt out, or an earlier entry of it ran
+        if(!(m->flags & material_burning) || sim->updated_tick[i] == sim->tick) continue;
 
-    simulation->width = width;
-    simulation->height = height;
-    simulation->particles = p;
-    simulation->texture_buffer = tex;
+        particle_t p = p_get(sim, i);
+        m->update(sim, &p, i % sim->width, i / sim->width);
+        updated++;
 
-    for(int i = 0; i < width * height; i++){
-        simulation->particles[i] = new_empty();
+        // A fire that moved was listed again where it went
+        if(materials[sim->ids[i]].flags & material_burning){
+            sim->fires[kept++] = i;
+        }
     }
+
+    int lit = sim->fire_count - count;
+    if(lit) memmove(&sim->fires[kept], &sim->fires[count], sizeof(int) * lit);
+    sim->fire_count = kept + lit;
+
+    atomic_fetch_add_explicit(&sim->visited_cells, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sim->updated_cells, updated, memory_order_relaxed);
 }
 
-void destroy_simulation(){
-    free(simulation->particles);
-    free(simulation->texture_buffer);
-    free(simulation);
+static void finish_chunk(void *arg, int c){
+    sand_simulation *sim = (sand_simulation *) arg;
+    sim_chunk *chunk = &sim->chunks[c];
+    chunk->dirty = chunk->next_dirty;
+    chunk->next_dirty = empty_rect();
 }
 
-void update_simulation(){
-    for(int y = 0; y < simulation->height; y++){
-        int dir = y % 2 == 0;
-        for(int x = dir ? 0 : simulation->width - 1; dir ? x < simulation->width : x >= 0; dir ? x++ : x--){
-            int i = get_index(x, y);
-            particle_t *p = &simulation->particles[i];
-            if(!p->updated){
-                p->update(p, x, y);
+// Chunks are visited bottom to top, so a falling body moves
+// as a whole like in a full sweep. Each row of chunks is
+// updated in two phases, even columns then odd ones.
+// Chunks of one phase are a whole chunk apart and no kernel
+// reaches further than __max_reach cells, so they never touch
+// the same cells. Without a pool the phases run on the
+// calling thread in the same order, so a seed steps the
+// same way with any number of threads.
+void sim_step(sand_simulation *sim){
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+
+    // Cells remember the tick they were last updated in, 0 means
+    // never. The stamps only need clearing when the counter wraps.
+    if(++sim->tick == 0){
+        memset(sim->updated_tick, 0, sim->width * sim->height);
+        sim->tick = 1;
+    }
+
+    for(int cy = 0; cy < sim->chunks_y; cy++){
+        for(int phase = 0; phase < 2; phase++){
+            int count = 0;
+            for(int cx = phase; cx < sim->chunks_x; cx += 2){
+                int c = cy * sim->chunks_x + cx;
+                if(sim->chunks[c].dirty.min_x < sim->chunks[c].dirty.max_x){
+                    sim->chunk_list[count++] = c;
+                }
             }
+            thread_pool_run(sim->pool, update_chunk, sim, count);
+        }
+    }
+
+    // Before finish_chunk, so cells woken by the
+    // fires are swept next tick and no later
+    burn_fires(sim);
+    thread_pool_run(sim->pool, finish_chunk, sim, chunk_count);
+}
+
+// Uses the calling thread plus threads - 1 workers,
+// a single thread steps the grid without a pool
+void sim_set_threads(sand_simulation *sim, int threads){
+    thread_pool_destroy(sim->pool);
+    sim->pool = NULL;
+
+    if(threads > 1){
+        sim->pool = thread_pool_create(threads);
+    }
+}
+
+// Chunk generators get their own stream derived from the seed
+void sim_seed(sand_simulation *sim, uint64_t seed){
+    rng_seed(&sim->rng, seed);
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    for(int c = 0; c < chunk_count; c++){
+        rng_seed(&sim->chunks[c].rng, seed ^ rng_mix(c + 1));
+    }
+}
+
+int in_bounds(sand_simulation *sim, int x, int y){
+    return (x >= 0 && x < sim->width && y >= 0 && y < sim->height);    
+}
+
+int get_index(sand_simulation *sim, int x, int y){
+    return y * sim->width + x;
+}
+
+// Empty cells only keep their id and variant,
+// the velocity and life time planes are left untouched
+inline particle_t p_get(sand_simulation *sim, int i){
+    particle_t p = {
+        .id = sim->ids[i],
+        .variant = sim->variants[i],
+        .velocity = {.x=0.0, .y=0.0},
+        .life_time = real(1.0),
+        .updated = sim->updated_tick[i] == sim->tick
+    };
+
+    if(p.id != empty_id){
+        p.velocity.x = sim->velocity_x[i];
+        p.velocity.y = sim->velocity_y[i];
+        p.life_time = sim->life_time[i];
+    }
+    return p;
+}
+
+// Writing a cell wakes its neighbourhood only if
+// something other than the updated flag changed,
+// the texture is left to sim_compose_texture
+inline void p_set(sand_simulation *sim, particle_t p, int i){
+    int recolor = sim->ids[i] != p.id || sim->variants[i] != p.variant;
+    int changed = recolor;
+
+    if((sim->ids[i] == empty_id) != (p.id == empty_id)){
+        flip_surface(sim, i % sim->width, i / sim->width);
+    }
+    if(sim->ids[i] != p.id){
+        update_classes(sim, i, sim->ids[i], p.id);
+        if(materials[p.id].flags & material_burning) list_fire(sim, i);
+    }
+
+    sim->ids[i] = p.id;
+    sim->variants[i] = p.variant;
+    sim->updated_tick[i] = p.updated ? sim->tick : 0;
+
+    if(p.id != empty_id){
+        changed = changed
+            || sim->velocity_x[i] != p.velocity.x
+            || sim->velocity_y[i] != p.velocity.y
+            || sim->life_time[i] != p.life_time;
+
+        sim->velocity_x[i] = p.velocity.x;
+        sim->velocity_y[i] = p.velocity.y;
+        sim->life_time[i] = p.life_time;
+    }
+
+    if(changed){
+        wake_area(sim, i % sim->width, i / sim->width, recolor);
+    }
+}
+
+// Move p from i to j and whatever was in j to i
+void p_swap(sand_simulation *sim, particle_t p, int i, int j){
+    p_set(sim, p_get(sim, j), i);
+    p_set(sim, p, j);
+}
+
+// Empty cells never read their velocity or life time,
+// so only the id and variant planes need resetting
+void sim_clear(sand_simulation *sim){
+    int n = sim->width * sim->height;
+    memset(sim->ids, empty_id, n);
+    memset(sim->variants, 0, n);
+    memset(sim->idle_ticks, 0, n);
+    memset((void *) sim->occupied, 0, sizeof(uint64_t) * sim->row_words * sim->height);
+    memset(sim->column_top, 0, sizeof(int) * sim->width);
+    memset(sim->column_empty, 0, sizeof(int) * sim->width);
+    atomic_store_explicit(&sim->columns_stale, 0, memory_order_relaxed);
+    sim->fire_count = 0;
+    sim->fires_lost = 0;
+
+    // Empty cells are displaceable, the padding
+    // past the last column stays clear
+    int words = sim->row_words * sim->height;
+    memset((void *) sim->class_masks[0], 0, sizeof(uint64_t) * words * class_count);
+    uint64_t last = sim->width % 64 ? ((uint64_t) 1 << (sim->width % 64)) - 1 : ~(uint64_t) 0;
+    for(int w = 0; w < words; w++){
+        uint64_t bits = w % sim->row_words == sim->row_words - 1 ? last : ~(uint64_t) 0;
+        atomic_store_explicit(&sim->class_masks[class_displaceable][w], bits, memory_order_relaxed);
+    }
+
+    for(int cy = 0; cy < sim->chunks_y; cy++){
+        for(int cx = 0; cx < sim->chunks_x; cx++){
+            sim_chunk *chunk = &sim->chunks[cy * sim->chunks_x + cx];
+            chunk->dirty = empty_rect();
+            chunk->next_dirty = empty_rect();
+            chunk->paint = chunk_rect(sim, cx, cy);
+        }
+    }
+}
+
+// Class table entries of n <= 8 cells side by side, cell k
+// in byte k. unknown is set by ids past the table.
+#define __byte_ones 0x0101010101010101ull
+
+static inline uint64_t class_bytes(const uint8_t *member, const uint8_t *ids, int n, int *unknown){
+    uint64_t word = 0;
+    if(n == 8) memcpy(&word, ids, sizeof(word));
+
+    // Eight cells of one material, like air or a pool
+    if(n == 8 && word == ids[0] * __byte_ones){
+        if(ids[0] >= material_count){
+            *unknown = 1;
+            return 0;
         }
+        return member[ids[0]] * __byte_ones;
     }
 
-    for(int i = 0; i < simulation->width * simulation->height; i++){
-        simulation->particles[i].updated = 0;
+    uint64_t packed = 0;
+    for(int k = 0; k < n; k++){
+        if(ids[k] >= material_count){
+            *unknown = 1;
+            continue;
+        }
+        packed |= (uint64_t) member[ids[k]] << (8 * k);
     }
+    return packed;
 }
 
-int in_bounds(int x, int y){
-    return (x >= 0 && x < simulation->width && y >= 0 && y < simulation->height);    
+// Gathers bit c of each of the eight bytes of v, byte k
+// going to bit k
+static inline uint64_t byte_bits(uint64_t v, int c){
+    return (((v >> c) & __byte_ones) * 0x0102040810204080ull) >> 56;
 }
 
-int get_index(int x, int y){
-    return y * simulation->width + x;
+// Column bounds from the occupancy mask. With top the rows
+// are walked down to the highest filled cell of each column,
+// otherwise up to the lowest empty one, until every column
+// is found. column_seen holds the columns already found.
+static void find_column_bounds(sand_simulation *sim, int top){
+    int *bounds = top ? sim->column_top : sim->column_empty;
+    uint64_t *seen = sim->column_seen;
+    memset(seen, 0, sizeof(uint64_t) * sim->row_words);
+
+    for(int x = 0; x < sim->width; x++){
+        bounds[x] = top ? 0 : sim->height;
+    }
+    int left = sim->width;
+    for(int k = 0; k < sim->height && left; k++){
+        int y = top ? sim->height - 1 - k : k;
+        const _Atomic uint64_t *row = &sim->occupied[y * sim->row_words];
+        for(int w = 0; w < sim->row_words; w++){
+            uint64_t bits = atomic_load_explicit(&row[w], memory_order_relaxed);
+            if(!top){
+                int n = sim->width - w * 64;
+                bits = ~bits & (n >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1);
+            }
+            bits &= ~seen[w];
+            seen[w] |= bits;
+            left -= __builtin_popcountll(bits);
+            while(bits){
+                bounds[w * 64 + __builtin_ctzll(bits)] = top ? y + 1 : y;
+                bits &= bits - 1;
+            }
+        }
+    }
 }
 
-void p_set(particle_t p, int i){
-    simulation->particles[i] = p;
+// Masks are built eight cells at a time from a table of the
+// classes of every material, then column bounds from the
+// occupancy mask. Rows are padded to whole words, so only
+// the last word of a row can be short.
+int sim_reindex(sand_simulation *sim){
+    // Bit class_count of an entry is the occupancy bit
+    uint8_t member[material_count];
+    for(int id = 0; id < material_count; id++){
+        member[id] = id != empty_id ? 1 << class_count : 0;
+        for(int c = 0; c < class_count; c++){
+            if(materials[id].flags & class_flags[c]) member[id] |= 1 << c;
+        }
+    }
+
+    int unknown = 0;
+    for(int y = 0; y < sim->height; y++){
+        const uint8_t *row = &sim->ids[y * sim->width];
+        for(int w = 0; w < sim->row_words; w++){
+            uint64_t bits[class_count + 1] = {0};
+            int end = (w + 1) * 64 < sim->width ? (w + 1) * 64 : sim->width;
+
+            for(int x = w * 64; x < end; x += 8){
+                uint64_t packed = class_bytes(member, &row[x], end - x < 8 ? end - x : 8, &unknown);
+                for(int c = 0; c <= class_count; c++){
+                    bits[c] |= byte_bits(packed, c) << (x & 63);
+                }
+            }
+
+            int k = y * sim->row_words + w;
+            atomic_store_explicit(&sim->occupied[k], bits[class_count], memory_order_relaxed);
+            for(int c = 0; c < class_count; c++){
+                atomic_store_explicit(&sim->class_masks[c][k], bits[c], memory_order_relaxed);
+            }
+        }
+    }
+    if(unknown) return 0;
+    atomic_store_explicit(&sim->columns_stale, 1, memory_order_relaxed);
+
+    rebuild_fires(sim);
+    for(int cy = 0; cy < sim->chunks_y; cy++){
+        for(int cx = 0; cx < sim->chunks_x; cx++){
+            sim->chunks[cy * sim->chunks_x + cx].paint = chunk_rect(sim, cx, cy);
+        }
+    }
+    return 1;
+}
 
-    int j = i * 4;
-    simulation->texture_buffer[j] = p.color.r;
-    simulation->texture_buffer[j + 1] = p.color.g;
-    simulation->texture_buffer[j + 2] = p.color.b;
-    simulation->texture_buffer[j + 3] = p.color.a;
+/*          Texture                     */
+static void compose_chunk(void *arg, int k){
+    sand_simulation *sim = (sand_simulation *) arg;
+    sim_chunk *chunk = &sim->chunks[sim->chunk_list[k]];
+    rect_t r = chunk->paint;
+    for(int y = r.min_y; y < r.max_y; y++){
+        for(int x = r.min_x; x < r.max_x; x++){
+            int i = get_index(sim, x, y);
+            uint32_t rgba = packed_color(sim->ids[i], sim->variants[i]);
+            memcpy(&sim->texture_buffer[i * 4], &rgba, sizeof(rgba));
+        }
+    }
+    chunk->paint = empty_rect();
 }
 
-void clear_particles(){
-    for(int i = 0; i < simulation->width * simulation->height; i++){
-        simulation->particles[i] = new_empty();
+// Recolors the cells that changed since the last call and
+// returns the area of the texture buffer that was rewritten.
+// Must not run at the same time as sim_step.
+rect_t sim_compose_texture(sand_simulation *sim){
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    rect_t painted = empty_rect();
+
+    int count = 0;
+    for(int c = 0; c < chunk_count; c++){
+        rect_t r = sim->chunks[c].paint;
+        if(r.min_x < r.max_x){
+            grow_rect(&painted, r.min_x, r.min_y, r.max_x, r.max_y);
+            sim->chunk_list[count++] = c;
+        }
     }
+
+    thread_pool_run(sim->pool, compose_chunk, sim, count);
+    return painted;
 }
 
 /*          Create particles            */
 particle_t new_empty(){
     particle_t p = {
         .id = empty_id,
-        .color = {.r=80, .g=200, .b=255, .a=255},
+        .variant = 0,
         .velocity = {.x=0, .y=0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_empty
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
@@ -88,11 +857,10 @@ particle_t new_empty(){
 particle_t new_sand(){
     particle_t p = {
         .id = sand_id,
-        .color = {.r=230, .g=205, .b=50, .a=255},
+        .variant = 0,
         .velocity = {.x=0.0, .y=0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_sand
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
@@ -100,24 +868,22 @@ particle_t new_sand(){
 particle_t new_water(){
     particle_t p = {
         .id = water_id,
-        .color = {.r=50, .g=120, .b=170, .a=255},
+        .variant = 0,
         .velocity = {.x=0.0, .y=0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_water
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
 
-particle_t new_coal(){
-    int c = (rand() % (50 - 25 + 1)) + 25;
+particle_t new_coal(rng_t *rng){
+    int c = rng_range(rng, 25, 50);
     particle_t p = {
         .id = coal_id,
-        .color = {.r=c, .g=c, .b=c, .a=255},
+        .variant = c,
         .velocity = {.x=0.0, .y=0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_coal
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
@@ -125,25 +891,22 @@ particle_t new_coal(){
 particle_t new_oil(){
     particle_t p = {
         .id = oil_id,
-        .color = {.r=130, .g=130, .b=105, .a=255},
+        .variant = 0,
         .velocity = {.x=0.0, .y=0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_oil
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
 
-particle_t new_fire(){
-    int g = (rand() % (200 - 100 + 1)) + 100;
-    // float life_time = ((10.0 - 1.0) * ((float)rand() / RAND_MAX)) + 1.0;
+particle_t new_fire(rng_t *rng){
+    int g = rng_range(rng, 100, 200);
     particle_t p = {
         .id = fire_id,
-        .color = {.r=230, .g=g, .b=50, .a=255},
+        .variant = g,
         .velocity = {0.0, 0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_fire
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
@@ -151,11 +914,10 @@ particle_t new_fire(){
 particle_t new_smoke(){
     particle_t p = {
         .id = smoke_id,
-        .color = {.r=70, .g=70, .b=70, .a=255},
+        .variant = 0,
         .velocity = {.x=0.0, .y=0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_smoke
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
@@ -163,1169 +925,609 @@ particle_t new_smoke(){
 particle_t new_steam(){
     particle_t p = {
         .id = steam_id,
-        .color = {.r=215, .g=215, .b=215, .a=255},
+        .variant = 0,
         .velocity = {.x=0.0, .y=0.0},
-        .life_time = 1.0,
-        .updated = 0,
-        .update = update_smoke
+        .life_time = real(1.0),
+        .updated = 0
     };
     return p;
 }
 
+// Constructor for a material id, for brushes and loaders
+particle_t new_particle(uint8_t id, rng_t *rng){
+    switch(id){
+        case sand_id: return new_sand();
+        case water_id: return new_water();
+        case coal_id: return new_coal(rng);
+        case oil_id: return new_oil();
+        case fire_id: return new_fire(rng);
+        case smoke_id: return new_smoke();
+        case steam_id: return new_steam();
+        default: return new_empty();
+    }
+}
 
 /*      Update particles        */
 
-/*      UPDATE EMPTY PARTICLE       */
-// Do nothing
-void update_empty(particle_t *p, int x, int y){
-    p_set(*p, get_index(x, y));
+// Generator of the chunk a kernel runs in, only that
+// chunk's task draws from it during a step
+static inline rng_t *cell_rng(sand_simulation *sim, int x, int y){
+    int c = (y / chunk_size) * sim->chunks_x + x / chunk_size;
+    return &sim->chunks[c].rng;
 }
 
+// Uniform in [0, 1]
+static inline real_t random_real(rng_t *rng){
+#ifdef sand_fixed_point
+    return (real_t) (rng_next(rng) >> (32 - real_shift));
+#else
+    return rng_float(rng);
+#endif
+}
 
-/*      UPDATE SAND PARTICLE        */
-// Try moving bellow else
-// try moving to both lower diagonals
-#define __sand_max_spread 2.0
-#define __sand_max_fall_speed -10.0
-#define __sand_sink_speed -2.0
-void update_sand(particle_t *p, int x, int y){
-    p->updated = 1;
-    int i = get_index(x, y);
-
-    // limit velocities if needed
-    if(p->velocity.x > __sand_max_spread) p->velocity.x = __sand_max_spread;
-    if(p->velocity.x < - __sand_max_spread) p->velocity.x = - __sand_max_spread;
-    if(p->velocity.y > 0.0) p->velocity.y = 0.0;
-    if(p->velocity.y < __sand_max_fall_speed) p->velocity.y = __sand_max_fall_speed;
-
-    int j;
-    int x_off, y_off, x_coord, y_coord;
-    
-    x_off = round(p->velocity.x);
-    y_off = round(p->velocity.y);
-
-    // Try moving bellow
-    x_coord = x + x_off;
-    y_coord = y - 1 + y_off;
-    
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-        
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.x *= 0.8;
-            p->velocity.y -= gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-            return;
-        }
+// 1 if the cells strictly between x and to on row y are empty
+static inline int path_clear(sand_simulation *sim, int x, int to, int y){
+    return x < to ? sim_row_clear(sim, y, x + 1, to) : sim_row_clear(sim, y, to + 1, x);
+}
 
-        if(temp.id == water_id || temp.id == oil_id){
-            p->velocity.x *= 0.6;
-            p->velocity.y -= gravity * 0.25;
-            if(p->velocity.y < __sand_sink_speed) p->velocity.y = __sand_sink_speed;
-
-            p_set(*p, j);
-            p_set(new_empty(), i);
-            // try to take water out
-            for(int col = -10; col <= 10; col++){
-                for(int row = 0; row <= 10; row++){
-                    if(in_bounds(row, col)){
-                        int index = get_index(x_coord + col, y_coord + row);
-                        if(simulation->particles[index].id == empty_id){
-                            p_set(temp, index);
-                            return;
-                        }
-                    }
-                }
-            }
-            return;
-        }
-    }
+/*      Kernel templates        */
+// Sand and coal, water and oil, smoke and steam only differ
+// in their tuning constants. Each family has one kernel body
+// taking a table of constants; every material gets its own
+// copy of it with the table folded in at compile time, so
+// adding a material of a family is one line in its table.
+#define __kernel_inline static inline __attribute__((always_inline))
+
+// Cells a falling or sliding particle can take
+static inline int is_open(uint8_t id){
+    return materials[id].flags & material_displaceable;
+}
 
-    // Try moving to the diagonal
-    // if x velocity is 0, choose a random direction;
-    if(p->velocity.x == 0.0){
-        int r = rand() % 2 ? -1 : 1;
-        p->velocity.x = r * (float)rand()/RAND_MAX * p->velocity.y;
-        if(p->velocity.x > __sand_max_spread) p->velocity.x = __sand_max_spread;
-        if(p->velocity.x < - __sand_max_spread) p->velocity.x = - __sand_max_spread;
+/*      POWDERS         */
+// Try moving bellow else
+// try moving to both lower diagonals.
+// Sinking into a liquid swaps the grain
+// with the liquid, so no liquid is lost.
+typedef struct {
+    real_const_t max_spread;
+    real_const_t max_fall_speed;
+    real_const_t slide_spread;      // x velocity limit of a random slide
+    real_const_t sink_speed;        // fastest fall inside a liquid
+    real_const_t sink_drag;         // x velocity kept sinking straight down
+    real_const_t sink_fall;         // y velocity lost sinking straight down
+    real_const_t sink_push;         // x velocity gained sinking on a diagonal
+    real_const_t sink_lift;         // y velocity gained sinking on a diagonal
+} powder_t;
+
+// name, max spread, max fall speed, slide spread, sink speed,
+// sink drag, sink fall, sink push, sink lift
+#define powder_table(X) \
+    X(sand, 2.0, -10.0, 2.0, -2.0, 0.6, gravity * 0.25, 0.5, gravity * 2) \
+    X(coal, 0.0, -10.0, 2.0, -5.0, 0.3, gravity * 0.75, 0.2, gravity * 1.5)
+
+// Moves the grain to j through empty space or a liquid,
+// returns 0 if the cell there is taken
+__kernel_inline int powder_move(sand_simulation *sim, particle_t *p, int i, int j, int dir, const powder_t *k){
+    uint8_t target = sim->ids[j];
+
+    if(is_open(target)){
+        p->velocity.x += dir * real(1.0);
+        p->velocity.y += real(gravity);
+        p_swap(sim, *p, i, j);
+        return 1;
     }
 
-    int dir = p->velocity.x > 0.0 ? 1 : -1;
-    x_off = round(p->velocity.x);
-
-
-    x_coord = x_off == 0 ? x + dir : x + x_off;
-    y_coord = y - 1;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.x += dir;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-        }
-
-        if(temp.id == water_id || temp.id == oil_id){
-            p->velocity.x += dir * 0.5;
-            p->velocity.y += gravity * 2;
-            if(p->velocity.y < __sand_sink_speed) p->velocity.y = __sand_sink_speed;
-
-            p_set(*p, j);
-            p_set(new_empty(), i);
-
-            // try to take water out
-            for(int row = 0; row <= 10; row++){
-                for(int col = -10; col <= 10; col++){
-                    if(in_bounds(row, col)){
-                        int index = get_index(x_coord + col, y_coord + row);
-                        if(simulation->particles[index].id == empty_id){
-                            p_set(temp, index);
-                            return;
-                        }
-                    }
-                }
-            }
-            return;
-        }
-    }
+    if(materials[target].flags & material_liquid){
+        p->velocity.x += dir * k->sink_push;
+        p->velocity.y += k->sink_lift;
+        if(p->velocity.y < k->sink_speed) p->velocity.y = k->sink_speed;
 
-    // Try opossite diagonal
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
-    x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.x -= dir;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-        }
-    
-        if(temp.id == water_id || temp.id == oil_id){
-            p->velocity.x += -dir * 0.5;
-            p->velocity.y += gravity * 2;
-            if(p->velocity.y < __sand_sink_speed) p->velocity.y = __sand_sink_speed;
-
-            p_set(*p, j);
-            p_set(new_empty(), i);
-            // try to take water out
-            for(int col = -10; col <= 10; col++){
-                for(int row = 0; row <= 10; row++){
-                    if(in_bounds(row, col)){
-                        int index = get_index(x_coord + col, y_coord + row);
-                        if(simulation->particles[index].id == empty_id){
-                            p_set(temp, index);
-                            return;
-                        }
-                    }
-                }
-            }
-            return;
-        }
+        // the liquid takes the place the grain left
+        p_swap(sim, *p, i, j);
+        return 1;
     }
-
-    p->velocity.y += gravity;
-    p->velocity.x = 0.0;
-    p_set(*p, i);
-    return;
+    return 0;
 }
 
-/*      UPDATE WATER PARTICLE       */
-// Try moving bellow else
-// try moving to the diagonals like sand.
-// Also try to move directly to the side
-#define __water_max_spread 8.0
-#define __water_max_fall_speed -10.0
-#define __water_sink_chance 0.10
-void update_water(particle_t *p, int x, int y){
+__kernel_inline void powder_update(sand_simulation *sim, particle_t *p, int x, int y, const powder_t *k){
+    rng_t *rng = cell_rng(sim, x, y);
     p->updated = 1;
-    int i = get_index(x, y);
+    int i = get_index(sim, x, y);
 
     // limit velocities if needed
-    if(p->velocity.x > __water_max_spread) p->velocity.x = __water_max_spread;
-    if(p->velocity.x < - __water_max_spread) p->velocity.x = - __water_max_spread;
+    if(p->velocity.x > k->max_spread) p->velocity.x = k->max_spread;
+    if(p->velocity.x < - k->max_spread) p->velocity.x = - k->max_spread;
     if(p->velocity.y > 0.0) p->velocity.y = 0.0;
-    if(p->velocity.y < __water_max_fall_speed) p->velocity.y = __water_max_fall_speed;
+    if(p->velocity.y < k->max_fall_speed) p->velocity.y = k->max_fall_speed;
 
     int j;
     int x_off, y_off, x_coord, y_coord;
-    
-    x_off = round(p->velocity.x);
-    y_off = round(p->velocity.y);
+
+    x_off = real_round(p->velocity.x);
+    y_off = real_round(p->velocity.y);
 
     // Try moving bellow
     x_coord = x + x_off;
     y_coord = y - 1 + y_off;
-    
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-        
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->life_time = 1.0;
-            p->velocity.x *= 0.8;
-            p->velocity.y -= gravity;
-            p_set(*p, j);
-            p_set(temp, i);
+
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
+
+        if(is_open(target)){
+            p->velocity.x = real_mul(p->velocity.x, real(0.8));
+            p->velocity.y -= real(gravity);
+            p_swap(sim, *p, i, j);
             return;
         }
 
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __water_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x *= 0.3;
-                p->velocity.y -= gravity * 0.5;
+        if(materials[target].flags & material_liquid){
+            p->velocity.x = real_mul(p->velocity.x, k->sink_drag);
+            p->velocity.y -= k->sink_fall;
+            if(p->velocity.y < k->sink_speed) p->velocity.y = k->sink_speed;
 
-                temp.velocity.x = 0.0;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
+            // the liquid takes the place the grain left
+            p_swap(sim, *p, i, j);
+            return;
         }
     }
-    
+
     // Try moving to the diagonal
     // if x velocity is 0, choose a random direction;
     if(p->velocity.x == 0.0){
-        int r = rand() % 2 ? -1 : 1;
-        p->velocity.x = r * (float)rand()/RAND_MAX * p->velocity.y;
-        if(p->velocity.x > __water_max_spread) p->velocity.x = __water_max_spread;
-        if(p->velocity.x < - __water_max_spread) p->velocity.x = - __water_max_spread;
+        int r = rng_next(rng) % 2 ? -1 : 1;
+        p->velocity.x = real_mul(r * random_real(rng), p->velocity.y);
+        if(p->velocity.x > k->slide_spread) p->velocity.x = k->slide_spread;
+        if(p->velocity.x < - k->slide_spread) p->velocity.x = - k->slide_spread;
     }
 
     int dir = p->velocity.x > 0.0 ? 1 : -1;
-    x_off = round(p->velocity.x);
-
+    x_off = real_round(p->velocity.x);
 
     x_coord = x_off == 0 ? x + dir : x + x_off;
     y_coord = y - 1;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->life_time = 1.0;
-            p->velocity.x += dir;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-            return;
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __water_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += dir * 0.5;
-                p->velocity.y += gravity * 2;
-                
-                p_set(*p, j);
-                p_set(temp, i);
-            }
-        }
+    if(in_bounds(sim, x_coord, y_coord)){
+        if(powder_move(sim, p, i, get_index(sim, x_coord, y_coord), dir, k)) return;
     }
 
     // Try opossite diagonal
-    float old_velocity = p->velocity.x;
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
+    p->velocity.x = real_mul(p->velocity.x, real(-0.5));
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->life_time = 1.0;
-            p->velocity.x += -dir;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-            return;
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __water_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += -dir;
-                p->velocity.y += gravity * 2;
-                
-                p_set(*p, j);
-                p_set(temp, i);
-            }
-        }
+    if(in_bounds(sim, x_coord, y_coord)){
+        if(powder_move(sim, p, i, get_index(sim, x_coord, y_coord), -dir, k)) return;
     }
 
-    // Try moving to the side
-    p->life_time -= 0.005;
-    p->velocity.x = old_velocity;
-    x_off = round(p->velocity.x);
-    x_coord = x_off == 0 ? x + dir : x + x_off;
-    y_coord = y;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            int k = abs(x_coord - x);
-            int blocked_path = 0;
-            for(int n = 1; n < k; n++){
-                if(simulation->particles[get_index(x + n, y_coord)].id != empty_id){
-                    blocked_path = 1;
-                    break;
-                }
-            }
-            if(!blocked_path){
-                if(p->life_time < 0.0){
-                    p->velocity.x *= 0.5;
-                }else{
-                    p->velocity.x += dir;
-                }
-                p->velocity.y += gravity;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __water_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += dir * 0.5;
-                p->velocity.y += gravity * 2;
+    p->velocity.y += real(gravity);
+    p->velocity.x = 0.0;
+    p_set(sim, *p, i);
+}
 
-                p_set(*p, j);
-                p_set(temp, i);
-            }
-        }
-    }
+/*      LIQUIDS         */
+// Try moving bellow else
+// try moving to the diagonals like sand.
+// Also try to move directly to the side.
+// Only the sign of the life time matters, it stops
+// counting down once negative so still liquid can sleep.
+// Sinking into the other liquid is random, so the cell
+// stays awake while it sits next to it.
+typedef struct {
+    real_const_t max_spread;
+    real_const_t max_fall_speed;
+    uint8_t sinks_into;             // liquid it swaps places with
+    uint32_t sink_chance;
+    int calm_displaced;             // the liquid sunk into straight down loses its x velocity
+    real_const_t push;              // x velocity gained moving on a diagonal or the side
+    real_const_t sink_push;         // x velocity gained sinking on a diagonal or the side
+    real_const_t back_sink_push;    // same, sinking on the opposite diagonal
+    real_const_t back_sink_lift;    // y velocity gained sinking on the opposite diagonal
+} liquid_t;
+
+// name, max spread, max fall speed, sinks into, sink chance,
+// calm displaced, push, sink push, back sink push, back sink lift
+#define liquid_table(X) \
+    X(water, 8.0, -10.0, oil_id, rng_threshold(0.10), 1, 1.0, 0.5, 1.0, gravity * 2) \
+    X(oil, 5.0, -10.0, water_id, rng_threshold(0.05), 0, 0.5, 0.25, 0.25, gravity * 0.5)
+
+// Random slides are limited like water whatever the liquid
+#define __liquid_slide_spread real(8.0)
+
+// Sinks into the cell j on a diagonal or the side,
+// returns 0 if the liquid there stayed
+__kernel_inline int liquid_sink(sand_simulation *sim, particle_t *p, int x, int y, int i, int j, real_const_t push, real_const_t lift, const liquid_t *k){
+    wake_cell(sim, x, y);
+    if(!rng_chance(cell_rng(sim, x, y), k->sink_chance)) return 0;
+
+    p->life_time = real(1.0);
+    p->velocity.x += push;
+    p->velocity.y += lift;
+    p_swap(sim, *p, i, j);
+    return 1;
+}
 
-    // Try other side
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
-    x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            int k = abs(x_coord - x);
-            int blocked_path = 0;
-            for(int n = 1; n < k; n++){
-                if(simulation->particles[get_index(x + n, y_coord)].id != empty_id){
-                    blocked_path = 1;
-                    break;
-                }
-            }
-            if(!blocked_path){
-                if(p->life_time < 0.0){
-                    p->velocity.x *= 0.5;
-                }else{
-                    p->velocity.x -= dir;
-                }
-                p->velocity.y += gravity;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
-        }
+// Moves to the side through empty space when nothing blocks
+// the way, still liquid creeps at half its speed
+__kernel_inline int liquid_flow(sand_simulation *sim, particle_t *p, int x, int y, int i, int j, int x_coord, int dir, const liquid_t *k){
+    if(!path_clear(sim, x, x_coord, y)) return 0;
 
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __water_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += -dir * 0.5;
-                p->velocity.y += gravity * 2;
-                
-                p_set(*p, j);
-                p_set(temp, i);
-            }
-        }
+    if(p->life_time < 0.0){
+        p->velocity.x = real_mul(p->velocity.x, real(0.5));
+    }else{
+        p->velocity.x += dir * k->push;
     }
-
-    p->velocity.y += gravity;
-    p->velocity.x = 0.0;
-    p_set(*p, i);
-    return;    
+    p->velocity.y += real(gravity);
+    p_swap(sim, *p, i, j);
+    return 1;
 }
 
-/*      UPDATE COAL PARTICLE        */
-// Try moving bellow or to diagonals like sand
-// but spreads less
-#define __coal_max_spread 0.0
-#define __coal_max_fall_speed -10.0
-#define __coal_sink_speed -5.0
-void update_coal(particle_t *p, int x, int y){
+__kernel_inline void liquid_update(sand_simulation *sim, particle_t *p, int x, int y, const liquid_t *k){
+    rng_t *rng = cell_rng(sim, x, y);
     p->updated = 1;
-    int i = get_index(x, y);
+    int i = get_index(sim, x, y);
 
     // limit velocities if needed
-    if(p->velocity.x > __coal_max_spread) p->velocity.x = __coal_max_spread;
-    if(p->velocity.x < - __coal_max_spread) p->velocity.x = - __coal_max_spread;
+    if(p->velocity.x > k->max_spread) p->velocity.x = k->max_spread;
+    if(p->velocity.x < - k->max_spread) p->velocity.x = - k->max_spread;
     if(p->velocity.y > 0.0) p->velocity.y = 0.0;
-    if(p->velocity.y < __coal_max_fall_speed) p->velocity.y = __coal_max_fall_speed;
+    if(p->velocity.y < k->max_fall_speed) p->velocity.y = k->max_fall_speed;
 
     int j;
     int x_off, y_off, x_coord, y_coord;
-    
-    x_off = round(p->velocity.x);
-    y_off = round(p->velocity.y);
+
+    x_off = real_round(p->velocity.x);
+    y_off = real_round(p->velocity.y);
 
     // Try moving bellow
     x_coord = x + x_off;
     y_coord = y - 1 + y_off;
-    
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-        
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.x *= 0.8;
-            p->velocity.y -= gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-            return;
-        }
-
-        if(temp.id == water_id || temp.id == oil_id){
-            p->velocity.x *= 0.3;
-            p->velocity.y -= gravity * 0.75;
-            if(p->velocity.y < __coal_sink_speed) p->velocity.y = __coal_sink_speed;
-
-            p_set(*p, j);
-            p_set(new_empty(), i);
-            // try to take water out
-            for(int col = -10; col <= 10; col++){
-                for(int row = 0; row <= 10; row++){
-                    if(in_bounds(row, col)){
-                        int index = get_index(x_coord + col, y_coord + row);
-                        if(simulation->particles[index].id == empty_id){
-                            p_set(temp, index);
-                            return;
-                        }
-                    }
-                }
-            }
-            return;
-        }
-    }
-
-    // Try moving to the diagonal
-    // if x velocity is 0, choose a random direction;
-    if(p->velocity.x == 0.0){
-        int r = rand() % 2 ? -1 : 1;
-        p->velocity.x = r * (float)rand()/RAND_MAX * p->velocity.y;
-        if(p->velocity.x > __sand_max_spread) p->velocity.x = __sand_max_spread;
-        if(p->velocity.x < - __sand_max_spread) p->velocity.x = - __sand_max_spread;
-    }
-
-    int dir = p->velocity.x > 0.0 ? 1 : -1;
-    x_off = round(p->velocity.x);
-
-
-    x_coord = x_off == 0 ? x + dir : x + x_off;
-    y_coord = y - 1;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.x += dir;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-            return;
-        }
-
-        if(temp.id == water_id || temp.id == oil_id){
-            p->velocity.x += dir * 0.2;
-            p->velocity.y += gravity * 1.5;
-            if(p->velocity.y < __coal_sink_speed) p->velocity.y = __coal_sink_speed;
-
-            p_set(*p, j);
-            p_set(new_empty(), i);
-            // try to take water out
-            for(int col = -10; col <= 10; col++){
-                for(int row = 0; row <= 10; row++){
-                    if(in_bounds(row, col)){
-                        int index = get_index(x_coord + col, y_coord + row);
-                        if(simulation->particles[index].id == empty_id){
-                            p_set(temp, index);
-                            return;
-                        }
-                    }
-                }
-            }
-            return;
-        }
-    }
 
-    // Try opossite diagonal
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
-    x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.x -= dir;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
-            return;
-        }
-
-        if(temp.id == water_id || temp.id == oil_id){
-            p->velocity.x += -dir * 0.2;
-            p->velocity.y += gravity * 1.5;
-            if(p->velocity.y < __coal_sink_speed) p->velocity.y = __coal_sink_speed;
-
-            p_set(*p, j);
-            p_set(new_empty(), i);
-            // try to take water out
-            for(int col = -10; col <= 10; col++){
-                for(int row = 0; row <= 10; row++){
-                    if(in_bounds(row, col)){
-                        int index = get_index(x_coord + col, y_coord + row);
-                        if(simulation->particles[index].id == empty_id){
-                            p_set(temp, index);
-                            return;
-                        }
-                    }
-                }
-            }
-            return;
-        }
-    }
-
-    p->velocity.y += gravity;
-    p->velocity.x = 0.0;
-    p_set(*p, i);
-    return;    
-}
-
-/*      UPDATE OIL PARTICLE         */
-// Try to move like water
-// but spreads less
-// hardly mixes with water
-#define __oil_max_spread 5.0
-#define __oil_max_fall_speed -10.0
-#define __oil_sink_chance 0.05
-void update_oil(particle_t *p, int x, int y){
-    p->updated = 1;
-    int i = get_index(x, y);
-
-    // limit velocities if needed
-    if(p->velocity.x > __oil_max_spread) p->velocity.x = __oil_max_spread;
-    if(p->velocity.x < - __oil_max_spread) p->velocity.x = - __oil_max_spread;
-    if(p->velocity.y > 0.0) p->velocity.y = 0.0;
-    if(p->velocity.y < __oil_max_fall_speed) p->velocity.y = __oil_max_fall_speed;
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
 
-    int j;
-    int x_off, y_off, x_coord, y_coord;
-    
-    x_off = round(p->velocity.x);
-    y_off = round(p->velocity.y);
-
-    // Try moving bellow
-    x_coord = x + x_off;
-    y_coord = y - 1 + y_off;
-    
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-        
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->life_time = 1.0;
-            p->velocity.x *= 0.8;
-            p->velocity.y -= gravity;
-            p_set(*p, j);
-            p_set(temp, i);
+        if(is_open(target)){
+            p->life_time = real(1.0);
+            p->velocity.x = real_mul(p->velocity.x, real(0.8));
+            p->velocity.y -= real(gravity);
+            p_swap(sim, *p, i, j);
             return;
         }
 
-        if(temp.id == water_id){
-            if(rand() < RAND_MAX * __oil_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x *= 0.3;
-                p->velocity.y -= gravity * 0.5;
+        if(target == k->sinks_into){
+            wake_cell(sim, x, y);
+            if(rng_chance(rng, k->sink_chance)){
+                p->life_time = real(1.0);
+                p->velocity.x = real_mul(p->velocity.x, real(0.3));
+                p->velocity.y -= real(gravity * 0.5);
 
-                p_set(*p, j);
-                p_set(temp, i);
+                particle_t temp = p_get(sim, j);
+                if(k->calm_displaced) temp.velocity.x = 0.0;
+                p_set(sim, temp, i);
+                p_set(sim, *p, j);
                 return;
             }
         }
     }
-    
+
     // Try moving to the diagonal
     // if x velocity is 0, choose a random direction;
     if(p->velocity.x == 0.0){
-        int r = rand() % 2 ? -1 : 1;
-        p->velocity.x = r * (float)rand()/RAND_MAX * p->velocity.y;
-        if(p->velocity.x > __water_max_spread) p->velocity.x = __water_max_spread;
-        if(p->velocity.x < - __water_max_spread) p->velocity.x = - __water_max_spread;
+        int r = rng_next(rng) % 2 ? -1 : 1;
+        p->velocity.x = real_mul(r * random_real(rng), p->velocity.y);
+        if(p->velocity.x > __liquid_slide_spread) p->velocity.x = __liquid_slide_spread;
+        if(p->velocity.x < - __liquid_slide_spread) p->velocity.x = - __liquid_slide_spread;
     }
 
     int dir = p->velocity.x > 0.0 ? 1 : -1;
-    x_off = round(p->velocity.x);
-
+    x_off = real_round(p->velocity.x);
 
     x_coord = x_off == 0 ? x + dir : x + x_off;
     y_coord = y - 1;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->life_time = 1.0;
-            p->velocity.x += dir * 0.5;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
+
+        if(is_open(target)){
+            p->life_time = real(1.0);
+            p->velocity.x += dir * k->push;
+            p->velocity.y += real(gravity);
+            p_swap(sim, *p, i, j);
             return;
         }
 
-        if(temp.id == water_id){
-            if(rand() < RAND_MAX * __oil_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += dir * 0.25;
-                p->velocity.y += gravity * 2;
-                
-                p_set(*p, j);
-                p_set(temp, i);
-            }
+        if(target == k->sinks_into){
+            if(liquid_sink(sim, p, x, y, i, j, dir * k->sink_push, real(gravity * 2), k)) return;
         }
     }
 
     // Try opossite diagonal
-    float old_velocity = p->velocity.x;
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
+    real_t old_velocity = p->velocity.x;
+    p->velocity.x = real_mul(p->velocity.x, real(-0.5));
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->life_time = 1.0;
-            p->velocity.x += -dir * 0.5;
-            p->velocity.y += gravity;
-            p_set(*p, j);
-            p_set(temp, i);
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
+
+        if(is_open(target)){
+            p->life_time = real(1.0);
+            p->velocity.x += -dir * k->push;
+            p->velocity.y += real(gravity);
+            p_swap(sim, *p, i, j);
             return;
         }
 
-        if(temp.id == water_id){
-            if(rand() < RAND_MAX * __oil_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += -dir * 0.25;
-                p->velocity.y += gravity * 0.5;
-                
-                p_set(*p, j);
-                p_set(temp, i);
-            }
+        if(target == k->sinks_into){
+            if(liquid_sink(sim, p, x, y, i, j, -dir * k->back_sink_push, k->back_sink_lift, k)) return;
         }
     }
 
     // Try moving to the side
-    p->life_time -= 0.005;
+    if(p->life_time >= 0.0) p->life_time -= real(0.005);
     p->velocity.x = old_velocity;
-    x_off = round(p->velocity.x);
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x + dir : x + x_off;
     y_coord = y;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            int k = abs(x_coord - x);
-            int blocked_path = 0;
-            for(int n = 1; n < k; n++){
-                if(simulation->particles[get_index(x + n, y_coord)].id != empty_id){
-                    blocked_path = 1;
-                    break;
-                }
-            }
-            if(!blocked_path){
-                if(p->life_time < 0.0){
-                    p->velocity.x *= 0.5;
-                }else{
-                    p->velocity.x += dir * 0.5;
-                }
-                p->velocity.y += gravity;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
+
+        if(is_open(target)){
+            if(liquid_flow(sim, p, x, y, i, j, x_coord, dir, k)) return;
         }
 
-        if(temp.id == water_id){
-            if(rand() < RAND_MAX * __oil_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x += dir * 0.25;
-                p->velocity.y += gravity * 2;
-                
-                p_set(*p, j);
-                p_set(temp, i);
-            }
+        if(target == k->sinks_into){
+            if(liquid_sink(sim, p, x, y, i, j, dir * k->sink_push, real(gravity * 2), k)) return;
         }
     }
 
     // Try other side
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
+    p->velocity.x = real_mul(p->velocity.x, real(-0.5));
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            int k = abs(x_coord - x);
-            int blocked_path = 0;
-            for(int n = 1; n < k; n++){
-                if(simulation->particles[get_index(x + n, y_coord)].id != empty_id){
-                    blocked_path = 1;
-                    break;
-                }
-            }
-            if(!blocked_path){
-                if(p->life_time < 0.0){
-                    p->velocity.x *= 0.5;
-                }else{
-                    p->velocity.x -= dir * 0.5;
-                }
-                p->velocity.y += gravity;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
+
+        if(is_open(target)){
+            if(liquid_flow(sim, p, x, y, i, j, x_coord, -dir, k)) return;
         }
 
-        if(temp.id == water_id){
-            if(rand() < RAND_MAX * __oil_sink_chance){
-                p->life_time = 1.0;
-                p->velocity.x -= dir * 0.25;
-                p->velocity.y += gravity * 2;
-                
-                // temp.velocity.y = 0.0;
-                p_set(*p, j);
-                p_set(temp, i);
-            }
+        if(target == k->sinks_into){
+            if(liquid_sink(sim, p, x, y, i, j, -dir * k->sink_push, real(gravity * 2), k)) return;
         }
     }
 
-    p->velocity.y += gravity;
+    p->velocity.y += real(gravity);
     p->velocity.x = 0.0;
-    p_set(*p, i);
-    return;
-
-    return;
+    p_set(sim, *p, i);
 }
 
+#define define_powder(name, spread, fall, slide, sink, drag, sink_fall, push, lift) \
+    void update_##name(sand_simulation *sim, particle_t *p, int x, int y){ \
+        static const powder_t k = { \
+            real(spread), real(fall), real(slide), real(sink), \
+            real(drag), real(sink_fall), real(push), real(lift) \
+        }; \
+        powder_update(sim, p, x, y, &k); \
+    }
+powder_table(define_powder)
+
+#define define_liquid(name, spread, fall, into, chance, calm, push, sink_push, back_push, back_lift) \
+    void update_##name(sand_simulation *sim, particle_t *p, int x, int y){ \
+        static const liquid_t k = { \
+            real(spread), real(fall), into, chance, calm, \
+            real(push), real(sink_push), real(back_push), real(back_lift) \
+        }; \
+        liquid_update(sim, p, x, y, &k); \
+    }
+liquid_table(define_liquid)
+
 /*      UPDATE FIRE PARTICLE        */
 // Fire have a short life time
 // Spreads by burning flamable materials
 // like coal and oil
 // Turns into steam on the water
-#define __fire_max_fall_speed -2.0
-#define __coal_burn_chance 0.01
-#define __oil_burn_chance 0.3
-#define __create_smoke_chance 0.010
-void update_fire(particle_t *p, int x, int y){
-    p->updated = 1;
-    int i = get_index(x, y);
-
-    if(rand() < RAND_MAX * __create_smoke_chance * 0.10){
-        int coords[] = {
-            get_index(x, y + 1),
-            get_index(x + 1, y + 1),
-            get_index(x - 1, y + 1),
-            get_index(x + 1, y),
-            get_index(x - 1, y),
-            get_index(x + 1, y - 1),
-            get_index(x - 1, y - 1)
-        };
-        int xs[] = {x, x + 1, x - 1, x + 1, x - 1, x + 1, x - 1};
-        int ys[] = {y + 1, y + 1, y + 1, y, y, y - 1, y - 1};
-        for(int n = 0; n < 7; n++){
-            if(in_bounds(xs[n], ys[n])){
-                if(simulation->particles[coords[n]].id == empty_id){
-                    p_set(new_smoke(), coords[n]);
-                    break;
-                }
-            }
-        }
-    }
-
-    // limit velocities if needed
-    if(p->velocity.y > 0.0) p->velocity.y = 0.0;
-    if(p->velocity.y < __fire_max_fall_speed) p->velocity.y = __fire_max_fall_speed;
-
-    int x_off, y_off, x_coord, y_coord;
-    int j;
-
-    // Try to spread bellow
-    if(in_bounds(x, y - 1)){
-        j = get_index(x, y - 1);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
-
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
-            }
-        }
-
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
-        }
-    }
-
-    // Try to spread to each side
-    if(in_bounds(x + 1, y)){
-        j = get_index(x + 1, y);
-        particle_t temp = simulation->particles[j];
+#define __fire_max_fall_speed real(-2.0)
+#define __coal_burn_chance rng_threshold(0.01)
+#define __oil_burn_chance rng_threshold(0.3)
+#define __create_smoke_chance rng_threshold(0.010)
+// 1 if the 3x3 block around the fire holds anything it
+// could burn, quench in or fill with smoke. Fire inside a
+// burnt out heap skips its neighbour tests.
+static inline int fire_reacts(sand_simulation *sim, int x, int y){
+    rect_t block = {.min_x = x - 1, .min_y = y - 1, .max_x = x + 2, .max_y = y + 2};
+    return sim_class_any(sim, class_displaceable, block)
+        || sim_class_any(sim, class_flammable, block)
+        || sim_class_any(sim, class_liquid, block);
+}
 
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
+// A fire staying in place only changes its own velocity
+// and life time, which no other kernel reads, so unlike
+// p_set this leaves its neighbours asleep and its chunk clean
+static inline void keep_burning(sand_simulation *sim, particle_t *p, int i){
+    sim->velocity_x[i] = p->velocity.x;
+    sim->velocity_y[i] = p->velocity.y;
+    sim->life_time[i] = p->life_time;
+    sim->updated_tick[i] = sim->tick;
+}
 
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
-            }
-        }
+// Burns or fills the neighbour j, returns 1 if
+// the fire was put out into steam by water there
+static inline int fire_touch(sand_simulation *sim, particle_t *p, rng_t *rng, int i, int j, int smoke){
+    uint8_t target = sim->ids[j];
 
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
+    if(target == empty_id && smoke){
+        if(rng_chance(rng, __create_smoke_chance)){
+            p_set(sim, new_smoke(), j);
         }
     }
 
-    if(in_bounds(x - 1, y)){
-        j = get_index(x - 1, y);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
-
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
-            }
-        }
-
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
+    if(target == coal_id){
+        if(rng_chance(rng, __coal_burn_chance)){
+            p->life_time = real(10.0);
+            p_set(sim, new_fire(rng), j);
+            sim->life_time[j] = real(10.0);
         }
     }
-    // Try to spread up
-    if(in_bounds(x, y + 1)){
-        j = get_index(x, y + 1);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
-
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
-            }
-        }
 
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
+    if(target == oil_id){
+        if(rng_chance(rng, __oil_burn_chance)){
+            p->life_time = real(1.0);
+            p_set(sim, new_fire(rng), j);
+            sim->life_time[j] = real(0.01);
         }
     }
 
-    // Try to spread on diagonals
-    if(in_bounds(x + 1, y - 1)){
-        j = get_index(x + 1, y - 1);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
-
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
-            }
-        }
-
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
-        }
+    if(target == water_id){
+        *p = new_steam();
+        p_set(sim, *p, i);
+        return 1;
     }
+    return 0;
+}
 
-    if(in_bounds(x - 1, y - 1)){
-        j = get_index(x - 1, y - 1);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
-
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
-
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
-            }
-        }
-
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
-        }
-    }
-
-    if(in_bounds(x + 1, y + 1)){
-        j = get_index(x + 1, y + 1);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
-
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
+void update_fire(sand_simulation *sim, particle_t *p, int x, int y){
+    rng_t *rng = cell_rng(sim, x, y);
+    p->updated = 1;
+    int i = get_index(sim, x, y);
 
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
+    // Puts smoke in the first empty cell above or beside
+    if(rng_chance(rng, __create_smoke_chance / 10)){
+        static const int around[7][2] = {
+            {0, 1}, {1, 1}, {-1, 1}, {1, 0}, {-1, 0}, {1, -1}, {-1, -1}
+        };
+        for(int n = 0; n < 7; n++){
+            int nx = x + around[n][0];
+            int ny = y + around[n][1];
+            if(in_bounds(sim, nx, ny) && sim->ids[get_index(sim, nx, ny)] == empty_id){
+                p_set(sim, new_smoke(), get_index(sim, nx, ny));
+                break;
             }
         }
-
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
-        }
     }
 
-    if(in_bounds(x - 1, y + 1)){
-        j = get_index(x - 1, y + 1);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            if(rand() < RAND_MAX * __create_smoke_chance){
-                p_set(new_smoke(), j);
-            }
-        }
+    // limit velocities if needed
+    if(p->velocity.y > 0.0) p->velocity.y = 0.0;
+    if(p->velocity.y < __fire_max_fall_speed) p->velocity.y = __fire_max_fall_speed;
 
-        if(temp.id == coal_id){
-            if(rand() < RAND_MAX * __coal_burn_chance){
-                p->life_time = 10.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 10.0;
-            }
-        }
+    int x_off, y_off, x_coord, y_coord;
+    int j;
 
-        if(temp.id == oil_id){
-            if(rand() < RAND_MAX * __oil_burn_chance){
-                p->life_time = 1.0;
-                p_set(new_fire(), j);
-                simulation->particles[j].life_time = 0.01;
-                // return;
+    // Try to spread bellow, to each side, up and on
+    // the diagonals. Fire fills empty neighbours with
+    // smoke, except the one on its right side.
+    static const int spread[8][3] = {
+        {0, -1, 1}, {1, 0, 0}, {-1, 0, 1}, {0, 1, 1},
+        {1, -1, 1}, {-1, -1, 1}, {1, 1, 1}, {-1, 1, 1}
+    };
+    if(fire_reacts(sim, x, y)){
+        for(int n = 0; n < 8; n++){
+            int nx = x + spread[n][0];
+            int ny = y + spread[n][1];
+            if(in_bounds(sim, nx, ny)){
+                if(fire_touch(sim, p, rng, i, get_index(sim, nx, ny), spread[n][2])) return;
             }
         }
-
-        if(temp.id == water_id){
-            *p = new_steam();
-            p_set(*p, i);
-            return;
-        }
     }
 
     // try to move bellow
-    x_off = round(p->velocity.x);
-    y_off = round(p->velocity.y);
+    x_off = real_round(p->velocity.x);
+    y_off = real_round(p->velocity.y);
     x_coord = x + x_off;
     y_coord = y - 1 + y_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+        uint8_t target = sim->ids[j];
         
-        if(temp.id == empty_id || temp.id == smoke_id || temp.id == steam_id){
-            p->velocity.y -= gravity * 0.25;
-            p->life_time -= 0.03;
+        if(is_open(target)){
+            p->velocity.y -= real(gravity * 0.25);
+            p->life_time -= real(0.03);
             if(p->life_time < 0.0){
-                if(rand() < RAND_MAX * __create_smoke_chance * 0.25){
+                if(rng_chance(rng, __create_smoke_chance / 4)){
                     *p = new_smoke();
                 }else{
                     *p = new_empty();
                 }
             }
-            p_set(*p, j);
-            p_set(temp, i);
+            p_swap(sim, *p, i, j);
             return;
         }
 
-        if(temp.id == water_id){
+        if(target == water_id){
             *p = new_steam();
-            p_set(*p, i);
+            p_set(sim, *p, i);
             return;
         }
     }
 
-    p->life_time -= 0.03;
+    p->life_time -= real(0.03);
     if(p->life_time < 0.0){
-        if(rand() < RAND_MAX * __create_smoke_chance * 0.25){
+        if(rng_chance(rng, __create_smoke_chance / 4)){
             *p = new_smoke();
         }else{
             *p = new_empty();
         }
-        p_set(*p, i);
+        p_set(sim, *p, i);
         return;
     }
 
-    p->velocity.y += gravity;
-    p_set(*p, i);
-    return;
+    p->velocity.y += real(gravity);
+    keep_burning(sim, p, i);
 }
 
-/*      UPDATE SMOKE PARTICLE       */
+/*      GASES           */
 // Try to fill spaces like water
-// but goes up
-#define __smoke_max_rise_speed 1.0
-#define __smoke_max_spread 1.0
-void update_smoke(particle_t *p, int x, int y){
+// but goes up, fades out when its life time runs out
+typedef struct {
+    real_const_t max_spread;
+    real_const_t max_rise_speed;
+    real_const_t fade;              // life time lost every tick
+    real_const_t rise_drag;         // x velocity kept rising straight up
+    real_const_t rise;              // y velocity gained rising
+    real_const_t push;              // x velocity gained moving on a diagonal or the side
+} gas_t;
+
+// name, max spread, max rise speed, fade, rise drag, rise, push
+#define gas_table(X) \
+    X(smoke, 1.0, 1.0, 0.005, 0.6, 0.3, 1.0) \
+    X(steam, 1.0, 1.0, 0.005, 0.6, 0.3, 1.0)
+
+__kernel_inline void gas_update(sand_simulation *sim, particle_t *p, int x, int y, const gas_t *k){
+    rng_t *rng = cell_rng(sim, x, y);
     p->updated = 1;
-    int i = get_index(x, y);
+    int i = get_index(sim, x, y);
 
-    p->life_time -= 0.005;
+    p->life_time -= k->fade;
     if(p->life_time < 0.0){
-        p_set(new_empty(), i);
+        p_set(sim, new_empty(), i);
         return;
     }
 
     // limit velocities if needed
-    if(p->velocity.x > __smoke_max_spread) p->velocity.x = __smoke_max_spread;
-    if(p->velocity.x < - __smoke_max_spread) p->velocity.x = - __smoke_max_spread;
+    if(p->velocity.x > k->max_spread) p->velocity.x = k->max_spread;
+    if(p->velocity.x < - k->max_spread) p->velocity.x = - k->max_spread;
     if(p->velocity.y < 0.0) p->velocity.y = 0.0;
-    if(p->velocity.y > __smoke_max_rise_speed) p->velocity.y = __smoke_max_rise_speed;
+    if(p->velocity.y > k->max_rise_speed) p->velocity.y = k->max_rise_speed;
 
     int j;
     int x_off, y_off, x_coord, y_coord;
-    
-    x_off = round(p->velocity.x);
-    y_off = round(p->velocity.y);
+
+    x_off = real_round(p->velocity.x);
+    y_off = real_round(p->velocity.y);
 
     // Try moving up
     x_coord = x + x_off;
     y_coord = y + 1 + y_off;
-    
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-        
-        if(temp.id == empty_id){
-            p->life_time = 1.0;
-            p->velocity.x *= 0.6;
-            p->velocity.y += 0.3;
-            p_set(*p, j);
-            p_set(temp, i);
+
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+
+        if(sim->ids[j] == empty_id){
+            p->life_time = real(1.0);
+            p->velocity.x = real_mul(p->velocity.x, k->rise_drag);
+            p->velocity.y += k->rise;
+            p_swap(sim, *p, i, j);
             return;
         }
     }
@@ -1333,113 +1535,87 @@ void update_smoke(particle_t *p, int x, int y){
     // Try moving to the diagonal
     // if x velocity is 0, choose a random direction;
     if(p->velocity.x == 0.0){
-        int r = rand() % 2 ? -1 : 1;
-        p->velocity.x = r * (float)rand()/RAND_MAX * p->velocity.y;
-        if(p->velocity.x > __smoke_max_spread) p->velocity.x = __smoke_max_spread;
-        if(p->velocity.x < - __smoke_max_spread) p->velocity.x = - __smoke_max_spread;
+        int r = rng_next(rng) % 2 ? -1 : 1;
+        p->velocity.x = real_mul(r * random_real(rng), p->velocity.y);
+        if(p->velocity.x > k->max_spread) p->velocity.x = k->max_spread;
+        if(p->velocity.x < - k->max_spread) p->velocity.x = - k->max_spread;
     }
 
     int dir = p->velocity.x > 0.0 ? 1 : -1;
-    x_off = round(p->velocity.x);
+    x_off = real_round(p->velocity.x);
 
     x_coord = x_off == 0 ? x + dir : x + x_off;
     y_coord = y + 1;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            p->velocity.x += dir;
-            p->velocity.y += 0.3;
-            p_set(*p, j);
-            p_set(temp, i);
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+
+        if(sim->ids[j] == empty_id){
+            p->velocity.x += dir * k->push;
+            p->velocity.y += k->rise;
+            p_swap(sim, *p, i, j);
             return;
         }
     }
 
     // Try opossite diagonal
-    float old_velocity = p->velocity.x;
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
+    real_t old_velocity = p->velocity.x;
+    p->velocity.x = real_mul(p->velocity.x, real(-0.5));
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            p->velocity.x += -dir;
-            p->velocity.y += 0.3;
-            p_set(*p, j);
-            p_set(temp, i);
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+
+        if(sim->ids[j] == empty_id){
+            p->velocity.x += -dir * k->push;
+            p->velocity.y += k->rise;
+            p_swap(sim, *p, i, j);
             return;
         }
     }
 
-    // Try moving to the side
+    // Try moving to the side,
+    // the life time is never negative here
     p->velocity.x = old_velocity;
-    x_off = round(p->velocity.x);
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x + dir : x + x_off;
     y_coord = y;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            int k = abs(x_coord - x);
-            int blocked_path = 0;
-            for(int n = 1; n < k; n++){
-                if(simulation->particles[get_index(x + n, y_coord)].id != empty_id){
-                    blocked_path = 1;
-                    break;
-                }
-            }
-            if(!blocked_path){
-                if(p->life_time < 0.0){
-                    p->velocity.x *= 0.5;
-                }else{
-                    p->velocity.x += dir;
-                }
-                p->velocity.y -= gravity * 0.25;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+
+        if(sim->ids[j] == empty_id && path_clear(sim, x, x_coord, y_coord)){
+            p->velocity.x += dir * k->push;
+            p->velocity.y -= real(gravity * 0.25);
+            p_swap(sim, *p, i, j);
+            return;
         }
     }
 
     // Try other side
-    p->velocity.x *= -0.5;
-    x_off = round(p->velocity.x);
+    p->velocity.x = real_mul(p->velocity.x, real(-0.5));
+    x_off = real_round(p->velocity.x);
     x_coord = x_off == 0 ? x - dir : x + x_off;
-    if(in_bounds(x_coord, y_coord)){
-        j = get_index(x_coord, y_coord);
-        particle_t temp = simulation->particles[j];
-
-        if(temp.id == empty_id){
-            int k = abs(x_coord - x);
-            int blocked_path = 0;
-            for(int n = 1; n < k; n++){
-                if(simulation->particles[get_index(x + n, y_coord)].id != empty_id){
-                    blocked_path = 1;
-                    break;
-                }
-            }
-            if(!blocked_path){
-                if(p->life_time < 0.0){
-                    p->velocity.x *= 0.5;
-                }else{
-                    p->velocity.x -= dir;
-                }
-                p->velocity.y -= gravity * 0.25;
-                p_set(*p, j);
-                p_set(temp, i);
-                return;
-            }
+    if(in_bounds(sim, x_coord, y_coord)){
+        j = get_index(sim, x_coord, y_coord);
+
+        if(sim->ids[j] == empty_id && path_clear(sim, x, x_coord, y_coord)){
+            p->velocity.x -= dir * k->push;
+            p->velocity.y -= real(gravity * 0.25);
+            p_swap(sim, *p, i, j);
+            return;
         }
     }
 
-    p->velocity.y -= gravity * 0.25;
+    p->velocity.y -= real(gravity * 0.25);
     p->velocity.x = 0.0;
-    p_set(*p, i);
-    return;
-}
\ No newline at end of file
+    p_set(sim, *p, i);
+}
+
+#define define_gas(name, spread, rise_speed, fade, drag, rise, push) \
+    void update_##name(sand_simulation *sim, particle_t *p, int x, int y){ \
+        static const gas_t k = { \
+            real(spread), real(rise_speed), real(fade), \
+            real(drag), real(rise), real(push) \
+        }; \
+        gas_update(sim, p, x, y, &k); \
+    }
+gas_table(define_gas)
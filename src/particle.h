@@ -2,6 +2,11 @@
 #define __PARTICLEH__
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "thread_pool.h"
+#include "rng.h"
+#include "real.h"
 
 typedef struct {
     uint8_t r;
@@ -10,35 +15,172 @@ typedef struct {
     uint8_t a;
 } color_t;
 
+// Working copy of a single cell, see p_get and p_set
 typedef struct particle_t {
     uint8_t id;
-    color_t color;
-    struct velocity {float x; float y;} velocity;
-    float life_time;
+    uint8_t variant;
+    struct velocity {real_t x; real_t y;} velocity;
+    real_t life_time;
     uint8_t updated;
-
-    void (*update)(struct particle_t*, int, int);
 } particle_t;
 
+// Cell rectangle, max is exclusive
+typedef struct {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+} rect_t;
+
+// The grid is split in chunk_size x chunk_size chunks.
+// Only the dirty rectangle of a chunk is updated each tick,
+// cells that change wake their neighbourhood for the next one.
+// Cells whose color changed are collected in paint
+// until sim_compose_texture writes them to the texture.
+// Kernels draw random numbers from the chunk they run in.
+typedef struct {
+    rect_t dirty;
+    rect_t next_dirty;
+    rect_t paint;
+    atomic_flag lock;
+    rng_t rng;
+} sim_chunk;
+
+// Material classes with their own occupancy mask, a cell
+// is in a class while its material has the class flag
+#define class_displaceable  0
+#define class_powder        1
+#define class_liquid        2
+#define class_flammable     3
+#define class_burning       4
+#define class_count         5
+
+// Cells are stored as one plane per field, four byte planes
+// and three real_t ones: 16 bytes a cell with floats and 10
+// in fixed point. Velocity and life time are only read and
+// written for non empty cells, but their planes are dense so
+// any cell is found by its index alone. Their values need
+// fractions of a cell per tick, which int8 or uint8 planes
+// would round away.
 typedef struct {
     int width;
     int height;
-    particle_t *particles;
+    uint8_t *ids;
+    uint8_t *variants;
+    uint8_t *updated_tick;
+    // Ticks a sleeping material ran without anything
+    // around it changing, reset by every wake
+    uint8_t *idle_ticks;
+    real_t *velocity_x;
+    real_t *velocity_y;
+    real_t *life_time;
     uint8_t *texture_buffer;
+
+    // Set when the cell planes above live in memory the world
+    // doesn't own, like a mapped snapshot. sim_destroy then
+    // hands planes_memory to release instead of freeing them.
+    void *planes_memory;
+    size_t planes_size;
+    void (*release_planes)(void *memory, size_t size);
+
+    int chunks_x;
+    int chunks_y;
+    sim_chunk *chunks;
+    int *chunk_list;
+
+    // Surface index. One bit per non empty cell with rows
+    // padded to whole words, kept up to date by p_set. Per
+    // column one past the highest non empty cell and the
+    // lowest empty one, rebuilt from the bits by the first
+    // query after a cell was filled or emptied.
+    int row_words;
+    _Atomic uint64_t *occupied;
+    int *column_top;
+    int *column_empty;
+    uint64_t *column_seen;
+    atomic_int columns_stale;
+
+    // One mask per material class, same layout as occupied,
+    // all of them in a single allocation
+    _Atomic uint64_t *class_masks[class_count];
+
+    // Indices of burning cells, appended by p_set when a cell
+    // catches fire. A cell may be listed twice or after it
+    // burnt out, sim_step drops those entries. fires_lost is
+    // set when the list couldn't grow, it is then rebuilt
+    // from the burning mask.
+    int *fires;
+    int fire_count;
+    int fire_capacity;
+    int fires_lost;
+
+    // NULL when stepping on the calling thread only
+    thread_pool *pool;
+
+    uint8_t tick;
+
+    // Random numbers for code outside of the step,
+    // like filling or painting the world
+    rng_t rng;
+
+    // Running totals of cells swept and kernels run
+    atomic_ullong visited_cells;
+    atomic_ullong updated_cells;
 } sand_simulation;
 
 #define gravity 1.0
+#define chunk_size 32
+
+// Furthest any kernel reads or writes from the cell it
+// updates (a grain falling at full speed plus the 3x3
+// block its write wakes).
+// Chunks updated in parallel are a chunk apart, so this
+// must stay below chunk_size / 2.
+#define __max_reach 12
+
+// Every function works on the world it is given, worlds
+// share no state and can be stepped on different threads
+sand_simulation *sim_create(int width, int height);
+void sim_destroy(sand_simulation *sim);
+void sim_step(sand_simulation *sim);
+void sim_set_threads(sand_simulation *sim, int threads);
+void sim_seed(sand_simulation *sim, uint64_t seed);
+void sim_clear(sand_simulation *sim);
+rect_t sim_compose_texture(sand_simulation *sim);
+
+// Same as sim_create but the seven cell planes are left NULL
+// and the world unfilled, for loaders that point them at
+// memory of their own. They are freed by sim_destroy unless
+// release_planes is set. sim_reindex must run once they hold
+// the cells.
+sand_simulation *sim_create_bare(int width, int height);
+
+// Rebuilds the surface index, the class masks and the fire
+// list from the id plane and repaints the whole texture, for
+// planes written without p_set. Returns 0 if a cell holds an
+// unknown id or memory runs out.
+int sim_reindex(sand_simulation *sim);
 
-extern sand_simulation *simulation;
+int in_bounds(sand_simulation *sim, int x, int y);
+int get_index(sand_simulation *sim, int x, int y);
+particle_t p_get(sand_simulation *sim, int i);
+void p_set(sand_simulation *sim, particle_t p, int i);
+void p_swap(sand_simulation *sim, particle_t p, int i, int j);
+void wake_cell(sand_simulation *sim, int x, int y);
 
-void init_simulation(int width, int height);
-void destroy_simulation();
-void update_simulation();
+// Cells of chunk c, the last row and column of chunks
+// are cut at the edge of the world
+rect_t sim_chunk_cells(sand_simulation *sim, int c);
 
-int in_bounds(int x, int y);
-int get_index(int x, int y);
-void p_set(particle_t p, int i);
-void clear_particles();
+// Surface queries, answered from the index without scanning
+// the id plane. Column bounds are rebuilt a word at a time
+// on the first query after the world changed, so they must
+// not be asked for while sim_step runs.
+int sim_column_top(sand_simulation *sim, int x);
+int sim_column_first_empty(sand_simulation *sim, int x);
+int sim_row_clear(sand_simulation *sim, int y, int x0, int x1);
+int sim_class_any(sand_simulation *sim, int class_id, rect_t r);
+int sim_class_count(sand_simulation *sim, int class_id, rect_t r);
 
 #define empty_id    (uint8_t)0
 #define sand_id     (uint8_t)1
@@ -49,22 +191,48 @@ void clear_particles();
 #define smoke_id    (uint8_t)6
 #define steam_id    (uint8_t)7
 
+#define material_count 8
+
+// Material flags
+#define material_displaceable   (uint8_t)(1 << 0)
+#define material_powder         (uint8_t)(1 << 1)
+#define material_liquid         (uint8_t)(1 << 2)
+#define material_gas            (uint8_t)(1 << 3)
+#define material_flammable      (uint8_t)(1 << 4)
+// Skipped once settled until a neighbour changes
+#define material_sleeps         (uint8_t)(1 << 5)
+// Sets flammable neighbours on fire
+#define material_burning        (uint8_t)(1 << 6)
+
+// One descriptor per material id, update is NULL for
+// materials that never change on their own
+typedef struct {
+    const char *name;
+    float density;
+    uint8_t flags;
+    void (*update)(sand_simulation *sim, particle_t *p, int x, int y);
+} material_t;
+
+extern const material_t materials[material_count];
+
+color_t particle_color(uint8_t id, uint8_t variant);
+
 particle_t new_empty(); 
 particle_t new_sand();  
 particle_t new_water(); 
-particle_t new_coal(); 
+particle_t new_coal(rng_t *rng);
 particle_t new_oil();
-particle_t new_fire();
+particle_t new_fire(rng_t *rng);
 particle_t new_smoke();
 particle_t new_steam();
+particle_t new_particle(uint8_t id, rng_t *rng);
 
-void update_empty(particle_t *p, int x, int y);
-void update_sand(particle_t *p, int x, int y);
-void update_water(particle_t *p, int x, int y);
-void update_coal(particle_t *p, int x, int y);
-void update_oil(particle_t *p, int x, int y);
-void update_fire(particle_t *p, int x, int y);
-void update_smoke(particle_t *p, int x, int y);
-void update_steam(particle_t *p, int x, int y);
+void update_sand(sand_simulation *sim, particle_t *p, int x, int y);
+void update_water(sand_simulation *sim, particle_t *p, int x, int y);
+void update_coal(sand_simulation *sim, particle_t *p, int x, int y);
+void update_oil(sand_simulation *sim, particle_t *p, int x, int y);
+void update_fire(sand_simulation *sim, particle_t *p, int x, int y);
+void update_smoke(sand_simulation *sim, particle_t *p, int x, int y);
+void update_steam(sand_simulation *sim, particle_t *p, int x, int y);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef __REALH__
+#define __REALH__
+
+#include <stdint.h>
+#include <math.h>
+
+// Velocity and life time math. Floats by default, with
+// sand_fixed_point defined they are int16 Q5.10 numbers,
+// so cells move the same on every machine and compiler.
+// Tuning constants are written as decimals and go
+// through real() at compile time in both modes.
+#ifdef sand_fixed_point
+
+typedef int16_t real_t;
+
+#define real_shift 10
+
+// Tuning constants kept in kernel parameter tables
+typedef real_t real_const_t;
+
+// Decimal constant to fixed point, rounded to nearest
+#define real(c) ((real_t) ((c) * (1 << real_shift) + ((c) < 0 ? -0.5 : 0.5)))
+
+static inline real_t real_mul(real_t a, real_t b){
+    return (real_t) (((int32_t) a * b) >> real_shift);
+}
+
+// Same as round(), halves go away from zero
+static inline int real_round(real_t v){
+    int half = 1 << (real_shift - 1);
+    return v >= 0 ? (v + half) >> real_shift : -((-v + half) >> real_shift);
+}
+
+static inline float real_to_float(real_t v){
+    return (float) v / (1 << real_shift);
+}
+
+#else
+
+typedef float real_t;
+
+// Constants stay doubles so float results match the
+// plain C expressions the kernels were written with
+typedef double real_const_t;
+#define real(c) (c)
+#define real_mul(a, b) ((a) * (b))
+
+static inline int real_round(real_t v){
+    return (int) roundf(v);
+}
+
+static inline float real_to_float(real_t v){
+    return v;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+#include <string.h>
+#include "rle.h"
+
+size_t rle_pack(const uint8_t *in, size_t n, uint8_t *out){
+    size_t i = 0;
+    size_t o = 0;
+    while(i < n){
+        size_t run = 1;
+        while(i + run < n && run < 130 && in[i + run] == in[i]) run++;
+        if(run >= 3){
+            out[o++] = (uint8_t) (125 + run);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        size_t start = i;
+        while(i < n && i - start < 128){
+            if(i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+            i++;
+        }
+        out[o++] = (uint8_t) (i - start - 1);
+        memcpy(&out[o], &in[start], i - start);
+        o += i - start;
+    }
+    return o;
+}
+
+int rle_unpack(const uint8_t *in, size_t size, uint8_t *out, size_t n){
+    size_t i = 0;
+    size_t o = 0;
+    while(i < size){
+        uint8_t c = in[i++];
+        if(c < 128){
+            size_t length = c + 1;
+            if(length > size - i || length > n - o) return 0;
+            memcpy(&out[o], &in[i], length);
+            i += length;
+            o += length;
+        }else{
+            size_t run = c - 125;
+            if(i == size || run > n - o) return 0;
+            memset(&out[o], in[i++], run);
+            o += run;
+        }
+    }
+    return o == n;
+}
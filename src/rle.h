@@ -0,0 +1,20 @@
+#ifndef __RLEH__
+#define __RLEH__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte run length code for planes saved to disk. Runs of 3 to
+// 130 equal bytes are a count byte of 125 plus the length and
+// the byte, everything else goes in literals of up to 128
+// bytes after a count byte of the length - 1.
+
+// Largest output for n bytes
+#define rle_bound(n) ((n) + (n) / 128 + 1)
+
+size_t rle_pack(const uint8_t *in, size_t n, uint8_t *out);
+
+// Returns 0 unless in decodes to exactly n bytes
+int rle_unpack(const uint8_t *in, size_t size, uint8_t *out, size_t n);
+
+#endif
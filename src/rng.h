@@ -0,0 +1,55 @@
+#ifndef __RNGH__
+#define __RNGH__
+
+#include <stdint.h>
+
+// Small xorshift64* generator. Every chunk owns one, so kernels
+// running on different threads never share random state and a
+// world steps the same way every time it starts from one seed.
+typedef struct {
+    uint64_t state;
+} rng_t;
+
+// Probability as a threshold for rng_chance, usable in
+// constant expressions so chances are computed at compile time
+#define rng_threshold(p) ((uint32_t)((p) * 4294967295.0))
+
+// splitmix64, spreads nearby seeds (chunk indices) apart
+static inline uint64_t rng_mix(uint64_t x){
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static inline void rng_seed(rng_t *rng, uint64_t seed){
+    rng->state = rng_mix(seed);
+    // xorshift never leaves 0
+    if(!rng->state) rng->state = 1;
+}
+
+static inline uint32_t rng_next(rng_t *rng){
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+// 1 with the probability the threshold was made from
+static inline int rng_chance(rng_t *rng, uint32_t threshold){
+    return rng_next(rng) < threshold;
+}
+
+// Uniform in [0, 1]
+static inline float rng_float(rng_t *rng){
+    return (rng_next(rng) >> 8) * (1.0f / 16777215.0f);
+}
+
+// Uniform in [min, max]
+static inline int rng_range(rng_t *rng, int min, int max){
+    return min + (int)(((uint64_t) rng_next(rng) * (uint32_t)(max - min + 1)) >> 32);
+}
+
+#endif
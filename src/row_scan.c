@@ -0,0 +1,29 @@
+#include <string.h>
+#include "row_scan.h"
+
+// Skips 8 empty cells per load, then finds the byte
+int find_occupied(const uint8_t *ids, int from, int to){
+    int x = from;
+    for(; x + 8 <= to; x += 8){
+        uint64_t word;
+        memcpy(&word, ids + x, sizeof(word));
+        if(word) break;
+    }
+    for(; x < to; x++){
+        if(ids[x]) return x;
+    }
+    return to;
+}
+
+int find_occupied_back(const uint8_t *ids, int from, int to){
+    int x = to;
+    for(; x - 8 >= from; x -= 8){
+        uint64_t word;
+        memcpy(&word, ids + x - 8, sizeof(word));
+        if(word) break;
+    }
+    for(x--; x >= from; x--){
+        if(ids[x]) return x;
+    }
+    return from - 1;
+}
@@ -0,0 +1,15 @@
+#ifndef __ROWSCANH__
+#define __ROWSCANH__
+
+#include <stdint.h>
+
+// Finds the non empty cells of a row of the id plane,
+// skipping eight empty cells per load
+
+// First x in [from, to) with a non zero id, to if none
+int find_occupied(const uint8_t *ids, int from, int to);
+
+// Last x in [from, to) with a non zero id, from - 1 if none
+int find_occupied_back(const uint8_t *ids, int from, int to);
+
+#endif
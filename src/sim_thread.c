@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sim_thread.h"
+#include "journal.h"
+#include "timing.h"
+
+#define __queue_size 256
+
+// The ready index carries this bit until the reader takes it
+#define __frame_fresh 4
+
+struct sim_thread {
+    sand_simulation *sim;
+    pthread_t thread;
+    atomic_int stop;
+
+    // Single producer single consumer ring, the writer
+    // owns tail and the simulation thread owns head
+    sim_command queue[__queue_size];
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+
+    // Triple buffer, the writer fills frames[back] while the
+    // reader holds frames[front], and the two swap their
+    // buffer with the one in ready
+    sim_frame frames[3];
+    int back;
+    int front;
+    _Alignas(64) atomic_int ready;
+
+    // Writer side. Pixels each buffer is missing since it was
+    // last filled, and changes since the last frame taken.
+    rect_t stale[3];
+    rect_t unread;
+
+    sim_input input;
+    // NULL when not recording
+    sim_journal *journal;
+
+    sim_schedule schedule;
+    atomic_ullong tick_count;
+    atomic_ullong frame_count;
+    atomic_ullong skipped_count;
+    atomic_ullong dropped_count;
+};
+
+static inline rect_t no_rect(){
+    rect_t r = {.min_x = INT_MAX, .min_y = INT_MAX, .max_x = INT_MIN, .max_y = INT_MIN};
+    return r;
+}
+
+static inline void merge_rect(rect_t *r, rect_t o){
+    if(o.min_x >= o.max_x) return;
+    if(o.min_x < r->min_x) r->min_x = o.min_x;
+    if(o.min_y < r->min_y) r->min_y = o.min_y;
+    if(o.max_x > r->max_x) r->max_x = o.max_x;
+    if(o.max_y > r->max_y) r->max_y = o.max_y;
+}
+
+static void sleep_until(double deadline){
+    struct timespec t;
+    t.tv_sec = (time_t) deadline;
+    t.tv_nsec = (long) ((deadline - t.tv_sec) * 1e9);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL));
+}
+
+void sim_input_run(sim_input *input, sand_simulation *sim, const sim_command *c){
+    switch(c->type){
+        case command_brush:
+            if(c->down && input->brush.down){
+                sim_paint_line(sim, input->brush.x, input->brush.y, c->x, c->y, c->radius, c->brush);
+                input->moved = 1;
+            }
+            input->brush = *c;
+        break;
+        case command_clear:
+            sim_clear(sim);
+        break;
+        case command_circle:
+            sim_paint_circle(sim, c->x, c->y, c->radius, c->brush);
+        break;
+        case command_line:
+            sim_paint_line(sim, c->x, c->y, c->x1, c->y1, c->radius, c->brush);
+        break;
+        case command_rect:
+            sim_paint_rect(sim, (rect_t){.min_x = c->x, .min_y = c->y, .max_x = c->x1, .max_y = c->y1}, c->brush);
+        break;
+    }
+}
+
+void sim_input_step(sim_input *input, sand_simulation *sim){
+    if(input->brush.down && !input->moved){
+        sim_paint_circle(sim, input->brush.x, input->brush.y, input->brush.radius, input->brush.brush);
+    }
+    sim_step(sim);
+    input->moved = 0;
+}
+
+static void run_commands(sim_thread *t){
+    unsigned head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&t->tail, memory_order_acquire);
+
+    for(; head != tail; head++){
+        const sim_command *c = &t->queue[head % __queue_size];
+        if(t->journal) sim_journal_command(t->journal, c);
+        sim_input_run(&t->input, t->sim, c);
+    }
+    atomic_store_explicit(&t->head, head, memory_order_release);
+}
+
+// Brings the back buffer up to date with the world texture,
+// then swaps it into ready. If the reader hasn't taken the
+// frame there yet, the new one also carries its changes.
+static void publish_frame(sim_thread *t, unsigned long long tick){
+    sand_simulation *sim = t->sim;
+    rect_t changed = sim_compose_texture(sim);
+
+    if(!(atomic_load_explicit(&t->ready, memory_order_relaxed) & __frame_fresh)){
+        t->unread = no_rect();
+    }
+    merge_rect(&t->unread, changed);
+
+    for(int b = 0; b < 3; b++){
+        merge_rect(&t->stale[b], changed);
+    }
+
+    sim_frame *f = &t->frames[t->back];
+    rect_t *r = &t->stale[t->back];
+    if(r->min_x < r->max_x){
+        int row_size = (r->max_x - r->min_x) * 4;
+        for(int y = r->min_y; y < r->max_y; y++){
+            int i = get_index(sim, r->min_x, y) * 4;
+            memcpy(&f->pixels[i], &sim->texture_buffer[i], row_size);
+        }
+    }
+    *r = no_rect();
+
+    f->changed = t->unread;
+    f->tick = tick;
+
+    int old = atomic_exchange_explicit(&t->ready, t->back | __frame_fresh, memory_order_acq_rel);
+    t->back = old & ~__frame_fresh;
+}
+
+// Runs one tick with the input queued before it. Painting
+// only happens here, between steps, so it never races one.
+static void run_tick(sim_thread *t){
+    run_commands(t);
+    sim_input_step(&t->input, t->sim);
+    if(t->journal) sim_journal_tick(t->journal, &t->input);
+}
+
+// Wall time is added to an accumulator and spent in whole
+// ticks. A batch of ticks ends after max_substeps of them or
+// once it ran for frame_budget, then one frame is published.
+// If more than a full batch of time is still owed afterwards,
+// the excess is dropped and the world falls behind wall time.
+static void *run_simulation(void *arg){
+    sim_thread *t = (sim_thread *) arg;
+    const sim_schedule *s = &t->schedule;
+    double dt = 1.0 / s->tick_rate;
+    double owed = dt;
+    double last = now_seconds();
+    unsigned long long tick = 0;
+
+    while(!atomic_load_explicit(&t->stop, memory_order_acquire)){
+        double now = now_seconds();
+        owed += now - last;
+        last = now;
+
+        int substeps = 0;
+        while(owed >= dt && substeps < s->max_substeps){
+            run_tick(t);
+            owed -= dt;
+            substeps++;
+            if(now_seconds() - now > s->frame_budget) break;
+        }
+
+        if(substeps){
+            publish_frame(t, tick += substeps);
+            atomic_fetch_add_explicit(&t->tick_count, substeps, memory_order_relaxed);
+            atomic_fetch_add_explicit(&t->frame_count, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&t->skipped_count, substeps - 1, memory_order_relaxed);
+        }
+
+        double limit = s->max_substeps * dt;
+        if(owed > limit){
+            unsigned long long dropped = (unsigned long long) ((owed - limit) / dt);
+            atomic_fetch_add_explicit(&t->dropped_count, dropped, memory_order_relaxed);
+            owed -= dropped * dt;
+        }
+
+        if(owed < dt){
+            sleep_until(last + dt - owed);
+        }
+    }
+    return NULL;
+}
+
+sim_thread *sim_thread_start(sand_simulation *sim, sim_schedule schedule){
+    return sim_thread_start_journal(sim, schedule, NULL);
+}
+
+sim_thread *sim_thread_start_journal(sand_simulation *sim, sim_schedule schedule, sim_journal *journal){
+    if(schedule.tick_rate <= 0.0 || schedule.max_substeps < 1) return NULL;
+
+    sim_thread *t = (sim_thread *) calloc(1, sizeof(sim_thread));
+    if(!t) return NULL;
+
+    t->sim = sim;
+    t->journal = journal;
+    t->schedule = schedule;
+    int size = sim->width * sim->height * 4;
+    for(int b = 0; b < 3; b++){
+        t->frames[b].pixels = (uint8_t *) malloc(size);
+        if(!t->frames[b].pixels){
+            for(int k = 0; k < b; k++) free(t->frames[k].pixels);
+            free(t);
+            return NULL;
+        }
+
+        // Every buffer starts missing the whole world
+        rect_t all = {.min_x = 0, .min_y = 0, .max_x = sim->width, .max_y = sim->height};
+        t->stale[b] = all;
+    }
+    t->back = 0;
+    t->front = 1;
+    atomic_init(&t->ready, 2);
+    atomic_init(&t->head, 0);
+    atomic_init(&t->tail, 0);
+    atomic_init(&t->stop, 0);
+    atomic_init(&t->tick_count, 0);
+    atomic_init(&t->frame_count, 0);
+    atomic_init(&t->skipped_count, 0);
+    atomic_init(&t->dropped_count, 0);
+    t->unread = no_rect();
+
+    if(pthread_create(&t->thread, NULL, run_simulation, t)){
+        for(int b = 0; b < 3; b++) free(t->frames[b].pixels);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void sim_thread_stop(sim_thread *t){
+    if(!t) return;
+
+    atomic_store_explicit(&t->stop, 1, memory_order_release);
+    pthread_join(t->thread, NULL);
+    for(int b = 0; b < 3; b++){
+        free(t->frames[b].pixels);
+    }
+    free(t);
+}
+
+sim_thread_stats sim_thread_get_stats(sim_thread *t){
+    sim_thread_stats stats = {
+        .ticks = atomic_load_explicit(&t->tick_count, memory_order_relaxed),
+        .frames = atomic_load_explicit(&t->frame_count, memory_order_relaxed),
+        .skipped_frames = atomic_load_explicit(&t->skipped_count, memory_order_relaxed),
+        .dropped_ticks = atomic_load_explicit(&t->dropped_count, memory_order_relaxed)
+    };
+    return stats;
+}
+
+int sim_thread_send(sim_thread *t, sim_command c){
+    unsigned tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&t->head, memory_order_acquire);
+    if(tail - head == __queue_size) return 0;
+
+    t->queue[tail % __queue_size] = c;
+    atomic_store_explicit(&t->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+const sim_frame *sim_thread_frame(sim_thread *t){
+    if(!(atomic_load_explicit(&t->ready, memory_order_relaxed) & __frame_fresh)) return NULL;
+
+    int old = atomic_exchange_explicit(&t->ready, t->front, memory_order_acq_rel);
+    t->front = old & ~__frame_fresh;
+    return &t->frames[t->front];
+}
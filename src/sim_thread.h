@@ -0,0 +1,112 @@
+#ifndef __SIMTHREADH__
+#define __SIMTHREADH__
+
+#include <stdint.h>
+#include "particle.h"
+#include "brush.h"
+
+// Steps a world on a thread of its own. Input reaches it
+// through a queue of commands run before every step, and
+// every step is published as a frame the render thread
+// takes without locks, always the latest one.
+
+// Commands run at the start of a tick, before the brush and
+// the step. command_brush moves the held brush, which paints
+// a circle every tick while it is down and a stroke from where
+// it was each time it moves. The others paint once.
+#define command_brush   0
+#define command_clear   1
+#define command_circle  2
+#define command_line    3
+#define command_rect    4
+
+typedef struct {
+    int type;
+
+    // Centre or first corner, in cells
+    int x;
+    int y;
+    // End of a line, or the corner past the rectangle
+    int x1;
+    int y1;
+    int radius;
+    brush_t brush;
+    int down;
+} sim_command;
+
+// The held brush, kept apart from the thread so a replay of
+// recorded commands paints the same way
+typedef struct {
+    sim_command brush;
+    // Set when the brush painted a stroke this tick
+    int moved;
+} sim_input;
+
+// Runs one command on the world
+void sim_input_run(sim_input *input, sand_simulation *sim, const sim_command *c);
+
+// Paints the held brush unless it moved this tick, then
+// steps the world. Ends the tick of the commands run before.
+void sim_input_step(sim_input *input, sand_simulation *sim);
+
+// RGBA rows of the whole world. changed covers every pixel
+// that differs from the frame taken before, it is empty when
+// nothing changed.
+typedef struct {
+    uint8_t *pixels;
+    rect_t changed;
+    unsigned long long tick;
+} sim_frame;
+
+// Fixed timestep scheduling. The world ticks tick_rate times
+// per second of wall time whatever the render rate. Ticks that
+// fell behind are run back to back, at most max_substeps of
+// them or for frame_budget seconds, and only the last one is
+// published, the frames in between are skipped. Time past
+// that is dropped, so a heavy scene slows the world clock
+// by a known amount instead of piling up work.
+typedef struct {
+    double tick_rate;
+    int max_substeps;
+    double frame_budget;
+} sim_schedule;
+
+#define sim_default_tick_rate       60.0
+#define sim_default_max_substeps    4
+#define sim_default_frame_budget    (1.0 / 30.0)
+
+// Running totals since the thread started
+typedef struct {
+    unsigned long long ticks;
+    unsigned long long frames;
+    unsigned long long skipped_frames;
+    unsigned long long dropped_ticks;
+} sim_thread_stats;
+
+typedef struct sim_thread sim_thread;
+typedef struct sim_journal sim_journal;
+
+// The world belongs to the thread until sim_thread_stop,
+// only its size may be read meanwhile. Returns NULL if the
+// schedule is invalid or the frames or the thread can't be
+// created.
+sim_thread *sim_thread_start(sand_simulation *sim, sim_schedule schedule);
+
+// Same as sim_thread_start, every command and tick is also
+// written to journal, see journal.h. The journal is closed by
+// the caller after sim_thread_stop.
+sim_thread *sim_thread_start_journal(sand_simulation *sim, sim_schedule schedule, sim_journal *journal);
+void sim_thread_stop(sim_thread *t);
+
+// Safe to call from any thread
+sim_thread_stats sim_thread_get_stats(sim_thread *t);
+
+// Called from one thread only, returns 0 if the queue is full
+int sim_thread_send(sim_thread *t, sim_command c);
+
+// Latest published frame, NULL if none was published since
+// the last call. It stays untouched until the next call.
+// Called from one thread only.
+const sim_frame *sim_thread_frame(sim_thread *t);
+
+#endif
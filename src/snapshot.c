@@ -0,0 +1,461 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "rle.h"
+
+/*          File layout                 */
+// The header, one record per chunk and the fire list, then
+// the planes from a 64 byte aligned offset. Uncompressed
+// planes follow each other, each one 64 byte aligned so the
+// mapped planes are aligned too. Compressed planes start with
+// the end of every block, one block per plane and chunk in
+// plane order, followed by the blocks.
+#define __snapshot_magic        "SANDSNAP"
+#define __snapshot_version      1
+#define __snapshot_byte_order   0x01020304u
+
+// Set when velocity and life time are fixed point
+#define __snapshot_fixed_point  (1 << 16)
+
+#define __plane_align   64
+#define __plane_count   7
+
+// Planes from this one on are only read for non empty cells
+#define __cell_planes   4
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t byte_order;
+    uint32_t real_size;
+    int32_t width;
+    int32_t height;
+    int32_t chunk_width;
+    uint32_t tick;
+    uint64_t rng;
+    uint32_t fire_count;
+    uint32_t fires_lost;
+    uint64_t planes_offset;
+    // Whole file, a cut off file is never read
+    uint64_t size;
+} snapshot_header;
+
+// Rectangles as min_x, min_y, max_x, max_y
+typedef struct {
+    uint64_t rng;
+    int32_t dirty[4];
+    int32_t next_dirty[4];
+} snapshot_chunk;
+
+static const int plane_cell_size[__plane_count] = {
+    1, 1, 1, 1, sizeof(real_t), sizeof(real_t), sizeof(real_t)
+};
+
+static uint8_t *get_plane(sand_simulation *sim, int p){
+    switch(p){
+        case 0: return sim->ids;
+        case 1: return sim->variants;
+        case 2: return sim->updated_tick;
+        case 3: return sim->idle_ticks;
+        case 4: return (uint8_t *) sim->velocity_x;
+        case 5: return (uint8_t *) sim->velocity_y;
+        default: return (uint8_t *) sim->life_time;
+    }
+}
+
+static void set_plane(sand_simulation *sim, int p, uint8_t *data){
+    switch(p){
+        case 0: sim->ids = data; break;
+        case 1: sim->variants = data; break;
+        case 2: sim->updated_tick = data; break;
+        case 3: sim->idle_ticks = data; break;
+        case 4: sim->velocity_x = (real_t *) data; break;
+        case 5: sim->velocity_y = (real_t *) data; break;
+        default: sim->life_time = (real_t *) data; break;
+    }
+}
+
+static inline uint64_t align_up(uint64_t offset){
+    return (offset + __plane_align - 1) / __plane_align * __plane_align;
+}
+
+static inline size_t plane_bytes(sand_simulation *sim, int p){
+    return (size_t) sim->width * sim->height * plane_cell_size[p];
+}
+
+/*          Saving                      */
+static int put(FILE *f, const void *data, size_t size, uint64_t *at){
+    *at += size;
+    return fwrite(data, 1, size, f) == size;
+}
+
+static int pad(FILE *f, uint64_t *at){
+    static const uint8_t zeros[__plane_align] = {0};
+    return put(f, zeros, align_up(*at) - *at, at);
+}
+
+// Cells [x0, x1) of row y of a plane. Velocity and life time
+// of empty cells are never read and are saved as 0, so equal
+// worlds save to equal files and runs of air pack down.
+static size_t copy_row(sand_simulation *sim, int p, int y, int x0, int x1, uint8_t *out){
+    int size = plane_cell_size[p];
+    int i = get_index(sim, x0, y);
+    size_t bytes = (size_t) (x1 - x0) * size;
+    memcpy(out, get_plane(sim, p) + (size_t) i * size, bytes);
+
+    if(p >= __cell_planes){
+        for(int x = 0; x < x1 - x0; x++){
+            if(sim->ids[i + x] == empty_id) memset(&out[x * size], 0, size);
+        }
+    }
+    return bytes;
+}
+
+static int write_planes(sand_simulation *sim, FILE *f, uint64_t *at){
+    uint8_t *row = (uint8_t *) malloc((size_t) sim->width * sizeof(real_t));
+    if(!row) return 0;
+
+    int ok = 1;
+    for(int p = 0; p < __plane_count && ok; p++){
+        for(int y = 0; y < sim->height && ok; y++){
+            ok = put(f, row, copy_row(sim, p, y, 0, sim->width, row), at);
+        }
+        ok = ok && pad(f, at);
+    }
+    free(row);
+    return ok;
+}
+
+// The block table is written last, over the zeros reserved
+// for it. Offsets are from start, where the snapshot begins.
+static int write_packed(sand_simulation *sim, FILE *f, off_t start, uint64_t *at){
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    int blocks = __plane_count * chunk_count;
+    size_t raw_size = (size_t) chunk_size * chunk_size * sizeof(real_t);
+
+    uint64_t *ends = (uint64_t *) calloc(blocks, sizeof(uint64_t));
+    uint8_t *raw = (uint8_t *) malloc(raw_size);
+    uint8_t *packed = (uint8_t *) malloc(rle_bound(raw_size));
+
+    uint64_t table = *at;
+    int ok = ends && raw && packed && put(f, ends, sizeof(uint64_t) * blocks, at);
+    uint64_t base = *at;
+
+    for(int k = 0; k < blocks && ok; k++){
+        int p = k / chunk_count;
+        rect_t r = sim_chunk_cells(sim, k % chunk_count);
+        size_t n = 0;
+        for(int y = r.min_y; y < r.max_y; y++){
+            n += copy_row(sim, p, y, r.min_x, r.max_x, &raw[n]);
+        }
+        ok = put(f, packed, rle_pack(raw, n, packed), at);
+        ends[k] = *at - base;
+    }
+
+    ok = ok && fseeko(f, start + (off_t) table, SEEK_SET) == 0
+        && fwrite(ends, sizeof(uint64_t), blocks, f) == (size_t) blocks
+        && fseeko(f, start + (off_t) *at, SEEK_SET) == 0;
+
+    free(ends);
+    free(raw);
+    free(packed);
+    return ok;
+}
+
+int sim_write_snapshot(sand_simulation *sim, FILE *f, int flags){
+    off_t start = ftello(f);
+    if(start < 0) return 0;
+
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    int fire_count = sim->fires_lost ? 0 : sim->fire_count;
+
+    snapshot_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, __snapshot_magic, sizeof(h.magic));
+    h.version = __snapshot_version;
+    h.flags = flags & snapshot_compressed;
+#ifdef sand_fixed_point
+    h.flags |= __snapshot_fixed_point;
+#endif
+    h.byte_order = __snapshot_byte_order;
+    h.real_size = sizeof(real_t);
+    h.width = sim->width;
+    h.height = sim->height;
+    h.chunk_width = chunk_size;
+    h.tick = sim->tick;
+    h.rng = sim->rng.state;
+    h.fire_count = fire_count;
+    h.fires_lost = sim->fires_lost;
+    h.planes_offset = align_up(sizeof(h) + sizeof(snapshot_chunk) * chunk_count + sizeof(int32_t) * fire_count);
+
+    uint64_t at = 0;
+    int ok = put(f, &h, sizeof(h), &at);
+
+    for(int c = 0; c < chunk_count && ok; c++){
+        const sim_chunk *chunk = &sim->chunks[c];
+        snapshot_chunk record = {
+            .rng = chunk->rng.state,
+            .dirty = {chunk->dirty.min_x, chunk->dirty.min_y, chunk->dirty.max_x, chunk->dirty.max_y},
+            .next_dirty = {chunk->next_dirty.min_x, chunk->next_dirty.min_y, chunk->next_dirty.max_x, chunk->next_dirty.max_y}
+        };
+        ok = put(f, &record, sizeof(record), &at);
+    }
+    for(int k = 0; k < fire_count && ok; k++){
+        int32_t i = sim->fires[k];
+        ok = put(f, &i, sizeof(i), &at);
+    }
+    ok = ok && pad(f, &at);
+
+    if(flags & snapshot_compressed){
+        ok = ok && write_packed(sim, f, start, &at);
+    }else{
+        ok = ok && write_planes(sim, f, &at);
+    }
+
+    h.size = at;
+    return ok && fseeko(f, start, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1
+        && fseeko(f, start + (off_t) at, SEEK_SET) == 0;
+}
+
+int sim_save(sand_simulation *sim, const char *path, int flags){
+    size_t length = strlen(path);
+    char *temp = (char *) malloc(length + 5);
+    if(!temp) return 0;
+    memcpy(temp, path, length);
+    memcpy(&temp[length], ".tmp", 5);
+
+    FILE *f = fopen(temp, "wb");
+    int ok = f && sim_write_snapshot(sim, f, flags);
+    if(f && fclose(f)) ok = 0;
+    if(ok && rename(temp, path)) ok = 0;
+    if(!ok) remove(temp);
+
+    free(temp);
+    return ok;
+}
+
+/*          Loading                     */
+static int valid_header(const snapshot_header *h, size_t size){
+    uint32_t fixed = 0;
+#ifdef sand_fixed_point
+    fixed = __snapshot_fixed_point;
+#endif
+    if(memcmp(h->magic, __snapshot_magic, sizeof(h->magic))
+        || h->version != __snapshot_version
+        || h->byte_order != __snapshot_byte_order
+        || (h->flags & ~(uint32_t) (snapshot_compressed | __snapshot_fixed_point))
+        || (h->flags & __snapshot_fixed_point) != fixed
+        || h->real_size != sizeof(real_t)
+        || h->chunk_width != chunk_size
+        || h->size != size
+        || h->tick > UINT8_MAX || h->fires_lost > 1
+        || h->fire_count > INT_MAX || h->planes_offset % __plane_align){
+        return 0;
+    }
+
+    // Every plane index and the texture must fit an int
+    if(h->width <= 0 || h->height <= 0 || (int64_t) h->width * h->height > INT_MAX / 4) return 0;
+
+    uint64_t n = (uint64_t) h->width * h->height;
+    uint64_t chunks = (uint64_t) ((h->width + chunk_size - 1) / chunk_size) * ((h->height + chunk_size - 1) / chunk_size);
+    if(h->planes_offset < sizeof(*h) + sizeof(snapshot_chunk) * chunks + sizeof(int32_t) * h->fire_count) return 0;
+
+    uint64_t end = h->planes_offset;
+    if(h->flags & snapshot_compressed){
+        end += sizeof(uint64_t) * __plane_count * chunks;
+    }else{
+        for(int p = 0; p < __plane_count; p++){
+            end = align_up(end + n * plane_cell_size[p]);
+        }
+    }
+    return end <= size;
+}
+
+// Dirty rectangles must lie in their chunk,
+// empty ones all read back the same
+static int read_rect(rect_t cells, const int32_t v[4], rect_t *r){
+    rect_t in = {.min_x = v[0], .min_y = v[1], .max_x = v[2], .max_y = v[3]};
+    if(in.min_x >= in.max_x || in.min_y >= in.max_y){
+        rect_t none = {.min_x = INT_MAX, .min_y = INT_MAX, .max_x = INT_MIN, .max_y = INT_MIN};
+        *r = none;
+        return 1;
+    }
+
+    *r = in;
+    return in.min_x >= cells.min_x && in.max_x <= cells.max_x
+        && in.min_y >= cells.min_y && in.max_y <= cells.max_y;
+}
+
+static int read_chunks(sand_simulation *sim, const uint8_t *file){
+    const snapshot_chunk *records = (const snapshot_chunk *) (file + sizeof(snapshot_header));
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+
+    for(int c = 0; c < chunk_count; c++){
+        sim_chunk *chunk = &sim->chunks[c];
+        rect_t cells = sim_chunk_cells(sim, c);
+        // xorshift never leaves 0
+        if(!records[c].rng) return 0;
+
+        chunk->rng.state = records[c].rng;
+        if(!read_rect(cells, records[c].dirty, &chunk->dirty)
+            || !read_rect(cells, records[c].next_dirty, &chunk->next_dirty)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void unmap_planes(void *memory, size_t size){
+    munmap(memory, size);
+}
+
+// The planes point into the mapping, which the world owns
+static void map_planes(sand_simulation *sim, uint8_t *file, size_t size){
+    sim->planes_memory = file;
+    sim->planes_size = size;
+    sim->release_planes = unmap_planes;
+
+    uint64_t offset = ((const snapshot_header *) file)->planes_offset;
+    for(int p = 0; p < __plane_count; p++){
+        set_plane(sim, p, file + offset);
+        offset = align_up(offset + plane_bytes(sim, p));
+    }
+}
+
+static int read_packed(sand_simulation *sim, const uint8_t *file, size_t size){
+    int chunk_count = sim->chunks_x * sim->chunks_y;
+    int blocks = __plane_count * chunk_count;
+    const uint64_t *ends = (const uint64_t *) (file + ((const snapshot_header *) file)->planes_offset);
+    const uint8_t *base = (const uint8_t *) &ends[blocks];
+    uint64_t data_size = size - (base - file);
+
+    uint8_t *raw = (uint8_t *) malloc((size_t) chunk_size * chunk_size * sizeof(real_t));
+    if(!raw) return 0;
+
+    int ok = 1;
+    uint64_t start = 0;
+    for(int k = 0; k < blocks && ok; k++){
+        int p = k / chunk_count;
+        int cell = plane_cell_size[p];
+        rect_t r = sim_chunk_cells(sim, k % chunk_count);
+        size_t row = (size_t) (r.max_x - r.min_x) * cell;
+        size_t n = row * (r.max_y - r.min_y);
+
+        ok = ends[k] >= start && ends[k] <= data_size
+            && rle_unpack(&base[start], ends[k] - start, raw, n);
+        for(int y = r.min_y; y < r.max_y && ok; y++){
+            memcpy(get_plane(sim, p) + (size_t) get_index(sim, r.min_x, y) * cell, &raw[(y - r.min_y) * row], row);
+        }
+        start = ends[k];
+    }
+    free(raw);
+    return ok;
+}
+
+// Replaces the list sim_reindex built, unless the saved
+// world had lost track of its fires
+static int read_fires(sand_simulation *sim, const uint8_t *file){
+    const snapshot_header *h = (const snapshot_header *) file;
+    if(h->fires_lost) return 1;
+
+    const int32_t *fires = (const int32_t *) (file + sizeof(*h) + sizeof(snapshot_chunk) * sim->chunks_x * sim->chunks_y);
+    int count = h->fire_count;
+    for(int k = 0; k < count; k++){
+        if(fires[k] < 0 || fires[k] >= sim->width * sim->height) return 0;
+    }
+
+    if(count > sim->fire_capacity){
+        int *list = (int *) realloc(sim->fires, sizeof(int) * count);
+        if(!list) return 0;
+        sim->fires = list;
+        sim->fire_capacity = count;
+    }
+    for(int k = 0; k < count; k++){
+        sim->fires[k] = fires[k];
+    }
+    sim->fire_count = count;
+    return 1;
+}
+
+static void copy_planes(sand_simulation *sim, const uint8_t *file){
+    uint64_t offset = ((const snapshot_header *) file)->planes_offset;
+    for(int p = 0; p < __plane_count; p++){
+        memcpy(get_plane(sim, p), file + offset, plane_bytes(sim, p));
+        offset = align_up(offset + plane_bytes(sim, p));
+    }
+}
+
+static int alloc_planes(sand_simulation *sim){
+    for(int p = 0; p < __plane_count; p++){
+        set_plane(sim, p, (uint8_t *) malloc(plane_bytes(sim, p)));
+        if(!get_plane(sim, p)) return 0;
+    }
+    return 1;
+}
+
+// With own the world takes file, a mapping, and the planes of
+// an uncompressed snapshot point into it. It only does so if
+// it loads, release_planes is then set.
+static sand_simulation *read_snapshot(uint8_t *file, size_t size, int own){
+    const snapshot_header *h = (const snapshot_header *) file;
+    if(size < sizeof(*h) || !valid_header(h, size)) return NULL;
+
+    sand_simulation *sim = sim_create_bare(h->width, h->height);
+    if(!sim) return NULL;
+
+    int compressed = h->flags & snapshot_compressed;
+    sim->tick = h->tick;
+    sim->rng.state = h->rng;
+    int ok = h->rng && read_chunks(sim, file);
+
+    if(compressed){
+        ok = ok && alloc_planes(sim) && read_packed(sim, file, size);
+    }else if(own){
+        map_planes(sim, file, size);
+    }else{
+        ok = ok && alloc_planes(sim);
+        if(ok) copy_planes(sim, file);
+    }
+    ok = ok && sim_reindex(sim) && read_fires(sim, file);
+
+    if(!ok){
+        // The caller keeps the mapping
+        if(sim->release_planes){
+            for(int p = 0; p < __plane_count; p++) set_plane(sim, p, NULL);
+            sim->release_planes = NULL;
+        }
+        sim_destroy(sim);
+        return NULL;
+    }
+    return sim;
+}
+
+sand_simulation *sim_load(const char *path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size < (off_t) sizeof(snapshot_header)){
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    uint8_t *file = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(file == MAP_FAILED) return NULL;
+
+    sand_simulation *sim = read_snapshot(file, size, 1);
+    if(!sim || !sim->release_planes) munmap(file, size);
+    return sim;
+}
+
+sand_simulation *sim_read_snapshot(const void *data, size_t size){
+    return read_snapshot((uint8_t *) data, size, 0);
+}
@@ -0,0 +1,41 @@
+#ifndef __SNAPSHOTH__
+#define __SNAPSHOTH__
+
+#include <stdio.h>
+#include "particle.h"
+
+// A world saved to one file: every cell plane, the tick, the
+// random state and the dirty rectangles of each chunk and the
+// fire list, so a loaded world steps exactly like the one that
+// was saved. Files are only read by builds with the same real_t
+// mode and chunk size, on a machine of the same byte order.
+//
+// Uncompressed files keep each plane as it is in memory. They
+// load by mapping the file copy on write, the planes point into
+// the mapping and pages are only read when a cell there is
+// touched, the file itself is never written.
+
+// Planes are stored per chunk with a byte run length code,
+// smaller on disk but loaded into memory of their own
+#define snapshot_compressed (1 << 0)
+
+// Writes through a temporary file renamed over path, so a
+// world mapped from path can be saved back to it. Must not
+// run at the same time as sim_step. Returns 0 on failure.
+int sim_save(sand_simulation *sim, const char *path, int flags);
+
+// Writes a snapshot at the current position of a seekable
+// stream and leaves it at the end, for files holding more
+// than one. Returns 0 on failure.
+int sim_write_snapshot(sand_simulation *sim, FILE *f, int flags);
+
+// The loaded world steps on the calling thread until
+// sim_set_threads. Returns NULL if the file can't be read,
+// is damaged or was written by an incompatible build.
+sand_simulation *sim_load(const char *path);
+
+// Same as sim_load for a snapshot held in memory, size bytes
+// from an 8 byte aligned address. The planes are copied.
+sand_simulation *sim_read_snapshot(const void *data, size_t size);
+
+#endif
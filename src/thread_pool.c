@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+// Task indices [start, end) a thread still has to run, packed
+// as end << 32 | start so owner and thieves can update it with
+// one compare and swap. Kept a cache line apart.
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} task_range;
+
+struct thread_pool {
+    int worker_count;
+    pthread_t *workers;
+    atomic_int worker_ids;
+
+    // One per thread, the caller is 0 and workers 1..worker_count
+    task_range *ranges;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    int running;
+    int stop;
+
+    // Current job
+    void (*task)(void *arg, int i);
+    void *arg;
+    int count;
+};
+
+static inline uint64_t pack_range(uint32_t start, uint32_t end){
+    return (uint64_t) end << 32 | start;
+}
+
+// Takes the first index of the thread's own range
+static int pop_task(task_range *r){
+    uint64_t old = atomic_load_explicit(&r->range, memory_order_relaxed);
+    for(;;){
+        uint32_t start = (uint32_t) old;
+        uint32_t end = (uint32_t) (old >> 32);
+        if(start >= end) return -1;
+        if(atomic_compare_exchange_weak(&r->range, &old, pack_range(start + 1, end))){
+            return (int) start;
+        }
+    }
+}
+
+// Moves the upper half of the victim's range into the thief's
+// and returns one index of it, -1 if the victim had nothing left
+static int steal_tasks(task_range *victim, task_range *thief){
+    uint64_t old = atomic_load_explicit(&victim->range, memory_order_relaxed);
+    for(;;){
+        uint32_t start = (uint32_t) old;
+        uint32_t end = (uint32_t) (old >> 32);
+        if(start >= end) return -1;
+        uint32_t mid = start + (end - start) / 2;
+        if(atomic_compare_exchange_weak(&victim->range, &old, pack_range(start, mid))){
+            atomic_store(&thief->range, pack_range(mid + 1, end));
+            return (int) mid;
+        }
+    }
+}
+
+// Every thread starts on its own slice of the job and runs it
+// in order, then steals half of what another thread has left.
+// A thread quits once no range has work, indices moved by a
+// steal are always run by the thief.
+static void run_tasks(thread_pool *pool, int self){
+    int threads = pool->worker_count + 1;
+    task_range *own = &pool->ranges[self];
+
+    for(;;){
+        int i = pop_task(own);
+        for(int k = 1; i < 0 && k < threads; k++){
+            i = steal_tasks(&pool->ranges[(self + k) % threads], own);
+        }
+        if(i < 0) return;
+        pool->task(pool->arg, i);
+    }
+}
+
+static void *worker_main(void *data){
+    thread_pool *pool = (thread_pool *) data;
+    int self = atomic_fetch_add(&pool->worker_ids, 1) + 1;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for(;;){
+        while(!pool->stop && pool->generation == seen){
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if(pool->stop) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_tasks(pool, self);
+
+        pthread_mutex_lock(&pool->mutex);
+        if(--pool->running == 0){
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+thread_pool *thread_pool_create(int threads){
+    thread_pool *pool = (thread_pool *) calloc(1, sizeof(thread_pool));
+    if(!pool) return NULL;
+
+    pool->worker_count = threads > 1 ? threads - 1 : 0;
+    pool->workers = (pthread_t *) malloc(sizeof(pthread_t) * (pool->worker_count + 1));
+    pool->ranges = (task_range *) aligned_alloc(_Alignof(task_range), sizeof(task_range) * (pool->worker_count + 1));
+    if(!pool->workers || !pool->ranges){
+        free(pool->workers);
+        free(pool->ranges);
+        free(pool);
+        return NULL;
+    }
+    atomic_init(&pool->worker_ids, 0);
+    for(int i = 0; i <= pool->worker_count; i++){
+        atomic_init(&pool->ranges[i].range, 0);
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for(int i = 0; i < pool->worker_count; i++){
+        if(pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0){
+            // Keep the workers that did start
+            pool->worker_count = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+void thread_pool_destroy(thread_pool *pool){
+    if(!pool) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(int i = 0; i < pool->worker_count; i++){
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->ranges);
+    free(pool);
+}
+
+void thread_pool_run(thread_pool *pool, void (*task)(void *arg, int i), void *arg, int count){
+    if(!pool || pool->worker_count == 0 || count <= 1){
+        for(int i = 0; i < count; i++){
+            task(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    int threads = pool->worker_count + 1;
+    for(int t = 0; t < threads; t++){
+        uint32_t start = (uint64_t) count * t / threads;
+        uint32_t end = (uint64_t) count * (t + 1) / threads;
+        atomic_store_explicit(&pool->ranges[t].range, pack_range(start, end), memory_order_relaxed);
+    }
+    pool->running = pool->worker_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_tasks(pool, 0);
+
+    // Workers still read the job fields until they check in
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->running > 0){
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+int cpu_count(){
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef __THREADPOOLH__
+#define __THREADPOOLH__
+
+typedef struct thread_pool thread_pool;
+
+// threads counts the calling thread, so a pool
+// of 4 threads starts 3 workers
+thread_pool *thread_pool_create(int threads);
+void thread_pool_destroy(thread_pool *pool);
+
+// Calls task(arg, i) for every i in [0, count) across
+// the workers and the caller, returns once all are done.
+// Each thread runs a contiguous slice and idle threads
+// steal from the others.
+void thread_pool_run(thread_pool *pool, void (*task)(void *arg, int i), void *arg, int count);
+
+int cpu_count();
+
+#endif
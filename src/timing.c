@@ -0,0 +1,8 @@
+#include <time.h>
+#include "timing.h"
+
+double now_seconds(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
@@ -0,0 +1,8 @@
+#ifndef __TIMINGH__
+#define __TIMINGH__
+
+// Seconds on a monotonic clock, for timing steps and
+// scheduling ticks
+double now_seconds();
+
+#endif
@@ -0,0 +1,19 @@
+#include "tools.h"
+
+void fill_world(sand_simulation *sim, int y0, int y1){
+    for(int y = y0; y < y1; y++){
+        for(int x = 0; x < sim->width; x++){
+            int i = get_index(sim, x, y);
+            switch(rng_next(&sim->rng) % 8){
+                case 0: p_set(sim, new_sand(), i); break;
+                case 1: p_set(sim, new_water(), i); break;
+                case 2: p_set(sim, new_coal(&sim->rng), i); break;
+                case 3: p_set(sim, new_oil(), i); break;
+            }
+        }
+    }
+
+    for(int x = 0; x < sim->width; x++){
+        p_set(sim, new_fire(&sim->rng), get_index(sim, x, y1));
+    }
+}
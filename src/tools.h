@@ -0,0 +1,14 @@
+#ifndef __TOOLSH__
+#define __TOOLSH__
+
+#include "particle.h"
+
+// Helpers shared by the command line tools, not part of the
+// simulation library
+
+// Fills rows [y0, y1) with a random mix of sand, water, coal
+// and oil from the world's generator and lays a line of fire
+// on row y1
+void fill_world(sand_simulation *sim, int y0, int y1);
+
+#endif
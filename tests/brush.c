@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "particle.h"
+#include "brush.h"
+#include "check.h"
+
+// Lines painted with sim_paint_line must cover exactly the
+// cells a disc stamped at every step of the segment covers,
+// for segments inside, across and far outside the world, and
+// brushes far wider than it
+
+#define __width     80
+#define __height    60
+#define __lines     3000
+
+// Marks every cell within the disc at every step, like the
+// brush with cells dx^2 + dy^2 <= radius^2 + radius
+static void naive_line(uint8_t *marked, long long x0, long long y0, long long x1, long long y1, long long radius){
+    long long dx = x1 - x0;
+    long long dy = y1 - y0;
+    long long steps = llabs(dx) > llabs(dy) ? llabs(dx) : llabs(dy);
+    long long limit = radius * radius + radius;
+
+    for(long long s = 0; s <= steps; s++){
+        long long px = steps ? x0 + llround((double) dx * s / steps) : x0;
+        long long py = steps ? y0 + llround((double) dy * s / steps) : y0;
+        if(px + radius < 0 || px - radius >= __width || py + radius < 0 || py - radius >= __height) continue;
+        for(int y = 0; y < __height; y++){
+            for(int x = 0; x < __width; x++){
+                if((x - px) * (x - px) + (y - py) * (y - py) <= limit) marked[y * __width + x] = 1;
+            }
+        }
+    }
+}
+
+static int compare(sand_simulation *sim, const uint8_t *marked, int x0, int y0, int x1, int y1, int radius){
+    int wrong = 0;
+    for(int i = 0; i < __width * __height; i++){
+        wrong += (sim->ids[i] == sand_id) != marked[i];
+    }
+    check(!wrong, "line (%d, %d)-(%d, %d) of radius %d: %d cells differ from the stamped discs",
+        x0, y0, x1, y1, radius, wrong);
+    return !wrong;
+}
+
+// A coordinate inside the world or up to 60 cells around it
+static int coordinate(int size){
+    return rand() % (size + 120) - 60;
+}
+
+int main(){
+    sand_simulation *sim = sim_create(__width, __height);
+    check(sim, "could not create the world");
+    if(!sim) return 1;
+    uint8_t *marked = (uint8_t *) malloc(__width * __height);
+    if(!marked) return 1;
+    brush_t sand = {sand_id, 1.0f};
+
+    srand(3);
+    for(int k = 0; k < __lines; k++){
+        int x0 = coordinate(__width);
+        int y0 = coordinate(__height);
+        int x1 = k % 4 == 0 ? x0 : coordinate(__width);
+        int y1 = k % 4 == 0 ? y0 : coordinate(__height);
+        int radius = k % 10 == 0 ? rand() % 80 : rand() % 12;
+
+        sim_clear(sim);
+        memset(marked, 0, __width * __height);
+        sim_paint_line(sim, x0, y0, x1, y1, radius, sand);
+        naive_line(marked, x0, y0, x1, y1, radius);
+        if(!compare(sim, marked, x0, y0, x1, y1, radius)) break;
+    }
+
+    // Segments millions of cells long crossing the world, only
+    // the steps near it can be walked
+    int far[][5] = {
+        {-4000000, 30, 4000000, 30, 3},
+        {40, -4000000, 41, 4000000, 2},
+        {-3000000, -3000000, 3000000, 3000000, 5},
+        {3000000, -10, -3000000, 70, 1},
+        {-4000000, -4000000, -3000000, 4000000, 4}
+    };
+    for(size_t k = 0; k < sizeof(far) / sizeof(far[0]); k++){
+        sim_clear(sim);
+        memset(marked, 0, __width * __height);
+        sim_paint_line(sim, far[k][0], far[k][1], far[k][2], far[k][3], far[k][4], sand);
+        naive_line(marked, far[k][0], far[k][1], far[k][2], far[k][3], far[k][4]);
+        compare(sim, marked, far[k][0], far[k][1], far[k][2], far[k][3], far[k][4]);
+    }
+
+    // A brush far wider than the world fills all of it from
+    // any cell of it, without sizing anything by its radius
+    sim_clear(sim);
+    sim_paint_circle(sim, 5, 7, 2000000000, sand);
+    int filled = 0;
+    for(int i = 0; i < __width * __height; i++){
+        filled += sim->ids[i] == sand_id;
+    }
+    check(filled == __width * __height, "a huge brush filled %d of %d cells", filled, __width * __height);
+
+    free(marked);
+    sim_destroy(sim);
+    return check_failures ? 1 : 0;
+}
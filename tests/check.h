@@ -0,0 +1,20 @@
+#ifndef __CHECKH__
+#define __CHECKH__
+
+#include <stdio.h>
+
+// Tests run every check and return the number that failed,
+// the first few failures are printed with their line
+static int check_failures = 0;
+
+#define check(cond, ...) do{ \
+    if(!(cond)){ \
+        if(check_failures++ < 20){ \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+        } \
+    } \
+}while(0)
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include "particle.h"
+#include "brush.h"
+#include "tools.h"
+#include "check.h"
+
+// Every class mask must hold exactly the cells whose material
+// has the class flag, after writes, swaps, steps and a
+// reindex, and the class queries must count them like a scan
+// of the ids on any rectangle
+
+#define __rounds 40
+
+static const uint8_t class_flag[class_count] = {
+    [class_displaceable] = material_displaceable,
+    [class_powder] = material_powder,
+    [class_liquid] = material_liquid,
+    [class_flammable] = material_flammable,
+    [class_burning] = material_burning
+};
+
+static int in_class(sand_simulation *sim, int c, int x, int y){
+    return (materials[sim->ids[y * sim->width + x]].flags & class_flag[c]) != 0;
+}
+
+// Compares every mask word and random queries against the
+// id plane, returns 1 if the world matched
+static int compare(sand_simulation *sim, const char *what){
+    int failures = check_failures;
+
+    for(int c = 0; c < class_count; c++){
+        for(int y = 0; y < sim->height; y++){
+            for(int w = 0; w < sim->row_words; w++){
+                uint64_t bits = 0;
+                for(int b = 0; b < 64 && w * 64 + b < sim->width; b++){
+                    if(in_class(sim, c, w * 64 + b, y)) bits |= (uint64_t) 1 << b;
+                }
+                uint64_t word = sim->class_masks[c][y * sim->row_words + w];
+                check(word == bits, "%s: class %d word %d of row %d is %llx, not %llx",
+                    what, c, w, y, (unsigned long long) word, (unsigned long long) bits);
+            }
+        }
+    }
+
+    // Rectangles start off word boundaries and may reach
+    // past any edge of the world
+    for(int k = 0; k < 300; k++){
+        int c = rand() % class_count;
+        rect_t r;
+        r.min_x = rand() % (sim->width + 40) - 20;
+        r.min_y = rand() % (sim->height + 40) - 20;
+        r.max_x = r.min_x + rand() % 140;
+        r.max_y = r.min_y + rand() % 60;
+
+        int count = 0;
+        for(int y = r.min_y < 0 ? 0 : r.min_y; y < r.max_y && y < sim->height; y++){
+            for(int x = r.min_x < 0 ? 0 : r.min_x; x < r.max_x && x < sim->width; x++){
+                count += in_class(sim, c, x, y);
+            }
+        }
+        check(sim_class_count(sim, c, r) == count, "%s: class %d count over (%d, %d)-(%d, %d) is %d, not %d",
+            what, c, r.min_x, r.min_y, r.max_x, r.max_y, sim_class_count(sim, c, r), count);
+        check(sim_class_any(sim, c, r) == (count > 0), "%s: class %d any over (%d, %d)-(%d, %d) is %d with %d cells",
+            what, c, r.min_x, r.min_y, r.max_x, r.max_y, sim_class_any(sim, c, r), count);
+    }
+    return failures == check_failures;
+}
+
+static void write_cells(sand_simulation *sim){
+    for(int k = rand() % 30; k > 0; k--){
+        int i = rand() % (sim->width * sim->height);
+        int j = rand() % (sim->width * sim->height);
+        if(rand() % 2){
+            p_set(sim, new_particle(rand() % material_count, &sim->rng), i);
+        }else{
+            p_swap(sim, p_get(sim, i), j, i);
+        }
+    }
+    if(rand() % 2){
+        int x = rand() % sim->width;
+        int y = rand() % sim->height;
+        sim_paint_circle(sim, x, y, rand() % 10, (brush_t){rand() % material_count, 0.5f});
+    }
+}
+
+int main(){
+    int sizes[][2] = {{128, 96}, {100, 70}, {65, 131}, {200, 40}};
+
+    srand(11);
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        sand_simulation *sim = sim_create(width, height);
+        check(sim, "could not create a %dx%d world", width, height);
+        if(!sim) return 1;
+        sim_seed(sim, 4);
+        sim_set_threads(sim, s % 2 ? 4 : 1);
+        compare(sim, "new world");
+
+        fill_world(sim, height / 4, height / 2);
+        int ok = compare(sim, "filled world");
+        for(int r = 0; r < __rounds && ok; r++){
+            write_cells(sim);
+            ok = compare(sim, "written");
+            for(int k = rand() % 6; k > 0 && ok; k--){
+                sim_step(sim);
+                ok = compare(sim, "stepped");
+            }
+        }
+
+        // Ids written straight into the plane, like a loaded
+        // snapshot, are picked up by sim_reindex
+        for(int k = 0; k < 500; k++){
+            sim->ids[rand() % (width * height)] = rand() % material_count;
+        }
+        check(sim_reindex(sim), "%dx%d: sim_reindex failed", width, height);
+        compare(sim, "reindexed");
+        sim_destroy(sim);
+    }
+    return check_failures ? 1 : 0;
+}
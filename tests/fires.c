@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include "particle.h"
+#include "brush.h"
+#include "check.h"
+
+// The fire list must set coal and oil alight, drop entries
+// for cells that burnt out or were listed twice, match the
+// burning mask after every step, and step the same when it
+// is rebuilt from the mask after it was lost
+
+#define __width     96
+#define __height    64
+#define __ticks     300
+
+// A coal heap and an oil pool on the floor with a line of
+// fire falling on them, the same for the same seed
+static sand_simulation *make_world(uint64_t seed){
+    sand_simulation *sim = sim_create(__width, __height);
+    if(!sim) return NULL;
+    sim_seed(sim, seed);
+    sim_paint_rect(sim, (rect_t){.min_x = 0, .min_y = 0, .max_x = __width / 2, .max_y = 16}, (brush_t){coal_id, 1.0f});
+    sim_paint_rect(sim, (rect_t){.min_x = __width / 2, .min_y = 0, .max_x = __width, .max_y = 8}, (brush_t){oil_id, 1.0f});
+    sim_paint_rect(sim, (rect_t){.min_x = 0, .min_y = 20, .max_x = __width, .max_y = 21}, (brush_t){fire_id, 1.0f});
+    return sim;
+}
+
+static int count_id(sand_simulation *sim, uint8_t id){
+    int count = 0;
+    for(int i = 0; i < sim->width * sim->height; i++){
+        count += sim->ids[i] == id;
+    }
+    return count;
+}
+
+// After a step every entry is a burning cell listed once, and
+// every burning cell is listed
+static void check_list(sand_simulation *sim, const char *what, int tick){
+    int n = sim->width * sim->height;
+    uint8_t *listed = (uint8_t *) calloc(n, 1);
+    if(!listed) return;
+
+    check(!sim->fires_lost, "%s: the list was lost on tick %d", what, tick);
+    for(int k = 0; k < sim->fire_count; k++){
+        int i = sim->fires[k];
+        check(i >= 0 && i < n, "%s: entry %d is %d on tick %d", what, k, i, tick);
+        if(i < 0 || i >= n) continue;
+        check(materials[sim->ids[i]].flags & material_burning,
+            "%s: cell %d is listed but not burning on tick %d", what, i, tick);
+        check(!listed[i], "%s: cell %d is listed twice on tick %d", what, i, tick);
+        listed[i] = 1;
+    }
+    for(int i = 0; i < n; i++){
+        if(materials[sim->ids[i]].flags & material_burning){
+            check(listed[i], "%s: burning cell %d isn't listed on tick %d", what, i, tick);
+        }
+    }
+    free(listed);
+}
+
+static void compare(sand_simulation *a, sand_simulation *b, int tick){
+    int n = a->width * a->height;
+    check(!memcmp(a->ids, b->ids, n), "rebuilt list: ids differ on tick %d", tick);
+    int lives = 1;
+    for(int i = 0; i < n; i++){
+        if(a->ids[i] != empty_id && a->life_time[i] != b->life_time[i]) lives = 0;
+    }
+    check(lives, "rebuilt list: life times differ on tick %d", tick);
+    check(a->fire_count == b->fire_count && !memcmp(a->fires, b->fires, sizeof(int) * a->fire_count),
+        "rebuilt list: fire lists differ on tick %d", tick);
+}
+
+int main(){
+    // Ignition and a list that stays exact while it burns
+    sand_simulation *sim = make_world(1);
+    check(sim, "could not create the world");
+    if(!sim) return 1;
+    int coal = count_id(sim, coal_id);
+    int oil = count_id(sim, oil_id);
+    for(int t = 0; t < __ticks; t++){
+        sim_step(sim);
+        check_list(sim, "burning world", t);
+    }
+    check(count_id(sim, coal_id) < coal, "no coal caught fire in %d ticks", __ticks);
+    check(count_id(sim, oil_id) < oil, "no oil caught fire in %d ticks", __ticks);
+    sim_destroy(sim);
+
+    // A cell that burnt out and one listed twice, by writes
+    // that run no kernel in between, on a sand floor that
+    // keeps the fire in place
+    sim = sim_create(64, 32);
+    check(sim, "could not create the floor world");
+    if(!sim) return 1;
+    sim_paint_rect(sim, (rect_t){.min_x = 0, .min_y = 0, .max_x = 64, .max_y = 4}, (brush_t){sand_id, 1.0f});
+    for(int t = 0; t < 10; t++){
+        sim_step(sim);
+    }
+    int stale = 4 * 64 + 10;
+    int twice = 4 * 64 + 40;
+    p_set(sim, new_fire(&sim->rng), stale);
+    p_set(sim, new_empty(), stale);
+    p_set(sim, new_fire(&sim->rng), twice);
+    p_set(sim, new_smoke(), twice);
+    p_set(sim, new_fire(&sim->rng), twice);
+    check(sim->fire_count == 3, "%d entries were listed for the stale and doubled cells, not 3", sim->fire_count);
+    sim_step(sim);
+    check(sim->ids[twice] == fire_id, "the doubled fire didn't stay in place");
+    check(sim->fire_count == 1 && sim->fires[0] == twice, "%d entries are left, not just the doubled cell", sim->fire_count);
+    check_list(sim, "floor world", 0);
+    sim_destroy(sim);
+
+    // The same world stepped once with its list rebuilt from
+    // the mask after the sweep, as a lost list is, and once
+    // with it rebuilt before the sweep by sim_reindex
+    sand_simulation *lost = make_world(2);
+    sand_simulation *rebuilt = make_world(2);
+    check(lost && rebuilt, "could not create the rebuilt worlds");
+    if(!lost || !rebuilt) return 1;
+    int failures = check_failures;
+    for(int t = 0; t < __ticks && failures == check_failures; t++){
+        lost->fires_lost = 1;
+        sim_reindex(rebuilt);
+        sim_step(lost);
+        sim_step(rebuilt);
+        compare(lost, rebuilt, t);
+        check_list(lost, "rebuilt list", t);
+    }
+    sim_destroy(lost);
+    sim_destroy(rebuilt);
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "journal.h"
+#include "tools.h"
+#include "check.h"
+
+// Records a world painted with brush and shape commands, then
+// replays it from the start and from keyframes, forwards and
+// backwards, against the ids and variants of every recorded
+// tick. A journal with one delta altered must diverge there.
+
+#define __width     128
+#define __height    96
+#define __ticks     120
+#define __interval  25
+#define __altered   40
+
+// Journal layout, enough to find a delta
+#define __header_size   32
+#define __record_size   24
+#define __delta_type    3
+
+static uint8_t *recorded[__ticks + 1];
+
+static void keep_tick(sand_simulation *sim, int tick){
+    int n = sim->width * sim->height;
+    recorded[tick] = (uint8_t *) malloc(2 * n);
+    memcpy(recorded[tick], sim->ids, n);
+    memcpy(recorded[tick] + n, sim->variants, n);
+}
+
+static int matches_tick(sim_replay *r, uint64_t tick){
+    sand_simulation *sim = sim_replay_world(r);
+    int n = sim->width * sim->height;
+    return sim_replay_tick(r) == tick
+        && !memcmp(recorded[tick], sim->ids, n)
+        && !memcmp(recorded[tick] + n, sim->variants, n);
+}
+
+// The commands run before a tick: a held brush dragged across
+// the world, shapes now and then and a clear halfway
+static int commands_for(int tick, sim_command *out){
+    int count = 0;
+    sim_command brush = {
+        .type = command_brush,
+        .x = 10 + tick % 100,
+        .y = 60 + (tick / 3) % 30,
+        .radius = 4,
+        .brush = {.id = tick < 60 ? sand_id : water_id, .density = 0.5f},
+        .down = tick % 30 < 20
+    };
+    if(tick % 4 == 0) out[count++] = brush;
+    if(tick % 17 == 5){
+        out[count++] = (sim_command) {.type = command_circle, .x = 30 + tick % 50, .y = 70, .radius = 6, .brush = {oil_id, 1.0f}};
+    }
+    if(tick == 33){
+        out[count++] = (sim_command) {.type = command_rect, .x = 5, .y = 40, .x1 = 120, .y1 = 44, .brush = {coal_id, 1.0f}};
+        out[count++] = (sim_command) {.type = command_line, .x = 0, .y = 90, .x1 = 127, .y1 = 50, .radius = 1, .brush = {fire_id, 1.0f}};
+    }
+    if(tick == 70) out[count++] = (sim_command) {.type = command_clear};
+    return count;
+}
+
+static int record(const char *path){
+    sand_simulation *sim = sim_create(__width, __height);
+    if(!sim) return 0;
+    sim_seed(sim, 11);
+    fill_world(sim, 0, __height / 3);
+    sim_set_threads(sim, 4);
+
+    sim_journal *journal = sim_journal_create(sim, path, __interval);
+    if(!journal){
+        sim_destroy(sim);
+        return 0;
+    }
+
+    sim_input input = {0};
+    keep_tick(sim, 0);
+    for(int t = 0; t < __ticks; t++){
+        sim_command commands[4];
+        int count = commands_for(t, commands);
+        for(int k = 0; k < count; k++){
+            sim_journal_command(journal, &commands[k]);
+            sim_input_run(&input, sim, &commands[k]);
+        }
+        sim_input_step(&input, sim);
+        sim_journal_tick(journal, &input);
+        keep_tick(sim, t + 1);
+    }
+
+    int ok = sim_journal_close(journal);
+    sim_destroy(sim);
+    return ok;
+}
+
+// Flips a byte in the chunk hash of the first changed chunk
+// of the delta ending tick, returns 0 if there is none
+static int alter_delta(const char *from, const char *to, uint64_t tick){
+    FILE *f = fopen(from, "rb");
+    if(!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *) malloc(size);
+    int ok = fread(data, 1, size, f) == (size_t) size;
+    fclose(f);
+
+    int altered = 0;
+    for(long at = __header_size; ok && at + __record_size <= size;){
+        uint32_t type;
+        uint64_t record_tick, payload;
+        memcpy(&type, &data[at], sizeof(type));
+        memcpy(&record_tick, &data[at + 8], sizeof(record_tick));
+        memcpy(&payload, &data[at + 16], sizeof(payload));
+        if(type == __delta_type && record_tick == tick && payload >= 16){
+            data[at + __record_size + 8] ^= 1;
+            altered = 1;
+            break;
+        }
+        at += __record_size + ((payload + 7) & ~(uint64_t) 7);
+    }
+
+    f = fopen(to, "wb");
+    ok = ok && altered && f && fwrite(data, 1, size, f) == (size_t) size;
+    if(f) fclose(f);
+    free(data);
+    return ok;
+}
+
+int main(){
+    const char *path = "test-journal.jrnl";
+    const char *altered_path = "test-altered.jrnl";
+    check(record(path), "could not record %s", path);
+
+    sim_replay *r = sim_replay_open(path, 2);
+    check(r, "could not open %s", path);
+    if(!r) return 1;
+    check(sim_replay_last_tick(r) == __ticks, "%llu ticks recorded", (unsigned long long) sim_replay_last_tick(r));
+    check(sim_replay_keyframes(r) == (__ticks - 1) / __interval + 1, "%d keyframes recorded", sim_replay_keyframes(r));
+
+    // Every tick from the start
+    check(sim_replay_seek(r, 0), "could not seek to tick 0");
+    check(matches_tick(r, 0), "the first keyframe differs");
+    while(sim_replay_step(r)){
+        check(matches_tick(r, sim_replay_tick(r)), "tick %llu differs", (unsigned long long) sim_replay_tick(r));
+    }
+    check(sim_replay_tick(r) == __ticks, "replay stopped at tick %llu", (unsigned long long) sim_replay_tick(r));
+    check(sim_replay_diverged(r) == 0, "replay diverged at tick %llu", (unsigned long long) sim_replay_diverged(r));
+
+    // Backwards across keyframes, then on from there
+    uint64_t seeks[] = {__ticks, 30, 74, 3, 51, 50, __ticks - 1};
+    for(size_t k = 0; k < sizeof(seeks) / sizeof(seeks[0]); k++){
+        check(sim_replay_seek(r, seeks[k]), "could not seek to tick %llu", (unsigned long long) seeks[k]);
+        check(matches_tick(r, seeks[k]), "seek to tick %llu differs", (unsigned long long) seeks[k]);
+        for(int t = 0; t < 10 && sim_replay_step(r); t++){
+            check(matches_tick(r, sim_replay_tick(r)), "tick %llu after a seek differs", (unsigned long long) sim_replay_tick(r));
+        }
+        check(sim_replay_diverged(r) == 0, "diverged at tick %llu after a seek", (unsigned long long) sim_replay_diverged(r));
+    }
+    check(!sim_replay_seek(r, __ticks + 1), "seeked past the last tick");
+    sim_replay_close(r);
+
+    // One altered delta is the first divergence, keyframes
+    // after it start clean
+    check(alter_delta(path, altered_path, __altered), "tick %d has no delta to alter", __altered);
+    r = sim_replay_open(altered_path, 1);
+    check(r, "could not open %s", altered_path);
+    if(r){
+        check(sim_replay_seek(r, __ticks), "could not replay %s", altered_path);
+        check(sim_replay_diverged(r) == 0, "a journal altered at tick %d diverges after its keyframe", __altered);
+        check(sim_replay_seek(r, 0) && sim_replay_seek(r, __altered + 5), "could not replay %s", altered_path);
+        check(sim_replay_diverged(r) == __altered,
+            "diverged at tick %llu, altered at %d", (unsigned long long) sim_replay_diverged(r), __altered);
+        sim_replay_close(r);
+    }
+
+    remove(path);
+    remove(altered_path);
+    for(int t = 0; t <= __ticks; t++){
+        free(recorded[t]);
+    }
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rle.h"
+#include "rng.h"
+#include "check.h"
+
+// Run length code round trips and sizes on edge cases
+
+static uint8_t packed[rle_bound(4096)];
+static uint8_t unpacked[4096];
+
+// Returns the packed size
+static size_t round_trip(const uint8_t *data, size_t n, const char *name){
+    size_t size = rle_pack(data, n, packed);
+    check(size <= rle_bound(n), "%s: %zu bytes packed to %zu, over the bound", name, n, size);
+    check(rle_unpack(packed, size, unpacked, n), "%s: %zu bytes don't unpack", name, n);
+    check(!memcmp(unpacked, data, n), "%s: %zu bytes unpack to other bytes", name, n);
+    return size;
+}
+
+int main(){
+    uint8_t data[4096] = {0};
+
+    // Empty input
+    check(round_trip(data, 0, "empty") == 0, "empty input packs to bytes");
+    check(!rle_unpack(packed, 0, unpacked, 1), "empty code unpacks to a byte");
+
+    // A single byte is a literal
+    data[0] = 0xAB;
+    check(round_trip(data, 1, "single") == 2, "a single byte isn't one literal");
+
+    // Runs around the longest one, 130 bytes
+    for(size_t n = 1; n <= 400; n++){
+        memset(data, 7, n);
+        size_t size = round_trip(data, n, "run");
+        if(n >= 3 && n <= 130) check(size == 2, "a run of %zu packs to %zu bytes", n, size);
+    }
+    memset(data, 7, 131);
+    check(round_trip(data, 131, "run") == 4, "a run of 131 isn't a run and a literal");
+    memset(data, 7, 260);
+    check(round_trip(data, 260, "run") == 4, "a run of 260 isn't two runs");
+
+    // No byte repeats, only literals of at most 128 bytes
+    for(size_t i = 0; i < sizeof(data); i++){
+        data[i] = (uint8_t) (i & 1);
+    }
+    size_t n = sizeof(data);
+    check(round_trip(data, n, "literal") == n + (n + 127) / 128, "literals don't take one count byte per 128");
+    check(round_trip(data, 128, "literal") == 129, "128 bytes aren't one literal");
+    check(round_trip(data, 129, "literal") == 131, "129 bytes aren't two literals");
+
+    // Random bytes with runs of random length
+    rng_t rng;
+    rng_seed(&rng, 5);
+    for(int t = 0; t < 200; t++){
+        size_t length = rng_next(&rng) % sizeof(data);
+        for(size_t i = 0; i < length;){
+            size_t run = 1 + rng_next(&rng) % (rng_next(&rng) % 2 ? 4 : 300);
+            uint8_t value = (uint8_t) rng_next(&rng);
+            for(; run && i < length; run--) data[i++] = value;
+        }
+        round_trip(data, length, "random");
+    }
+
+    // Code for another size or cut short is rejected
+    memset(data, 3, 100);
+    data[50] = 4;
+    size_t size = rle_pack(data, 100, packed);
+    check(!rle_unpack(packed, size, unpacked, 99), "code unpacks to fewer bytes than it holds");
+    check(!rle_unpack(packed, size, unpacked, 101), "code unpacks to more bytes than it holds");
+    check(!rle_unpack(packed, size - 1, unpacked, 100), "cut off code unpacks");
+    packed[0] = 127;
+    check(!rle_unpack(packed, size, unpacked, 100), "a literal past the end unpacks");
+
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include "row_scan.h"
+#include "rng.h"
+#include "check.h"
+
+// The word at a time row scan against a byte at a time
+// loop, on random rows and ranges. Rows end at the
+// end of their allocation, so a scan reading past to shows
+// up under a sanitizer.
+
+#define __rows      4000
+#define __max_row   300
+
+static int naive_forward(const uint8_t *ids, int from, int to){
+    for(int x = from; x < to; x++){
+        if(ids[x]) return x;
+    }
+    return to;
+}
+
+static int naive_back(const uint8_t *ids, int from, int to){
+    for(int x = to - 1; x >= from; x--){
+        if(ids[x]) return x;
+    }
+    return from - 1;
+}
+
+int main(){
+    rng_t rng;
+    rng_seed(&rng, 1);
+    for(int r = 0; r < __rows; r++){
+        int length = 1 + rng_next(&rng) % __max_row;
+        uint8_t *ids = (uint8_t *) malloc(length);
+
+        // Empty rows, lone cells and dense rows
+        int density = rng_next(&rng) % 4;
+        for(int x = 0; x < length; x++){
+            uint32_t roll = rng_next(&rng);
+            ids[x] = density == 0 ? 0
+                : density == 1 ? (roll % 97 == 0 ? 1 + roll % 7 : 0)
+                : density == 2 ? (roll % 9 == 0 ? 1 + roll % 7 : 0)
+                : roll % 2;
+        }
+
+        // Short ranges leave tails below a word
+        int from = rng_next(&rng) % (length + 1);
+        int span = rng_next(&rng) % 2 ? rng_next(&rng) % 40 : rng_next(&rng) % (length + 1);
+        int to = from + span > length ? length : from + span;
+
+        int forward = find_occupied(ids, from, to);
+        int back = find_occupied_back(ids, from, to);
+        check(forward == naive_forward(ids, from, to),
+            "forward [%d, %d) of %d: %d, expected %d", from, to, length, forward, naive_forward(ids, from, to));
+        check(back == naive_back(ids, from, to),
+            "back [%d, %d) of %d: %d, expected %d", from, to, length, back, naive_back(ids, from, to));
+        free(ids);
+    }
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim_thread.h"
+#include "timing.h"
+#include "check.h"
+
+// Frames taken from a running sim_thread must never change
+// while they are held, must cover every pixel that changed
+// since the frame taken before even when frames in between
+// were skipped, and a schedule the thread can't keep up with
+// must run at most max_substeps ticks per frame
+
+#define __width     64
+#define __height    48
+#define __frames    60
+// Seconds to take them in, however slow the build
+#define __deadline  10.0
+#define __run_time  0.4
+
+static void sleep_ms(int ms){
+    struct timespec t = {.tv_sec = 0, .tv_nsec = ms * 1000000L};
+    nanosleep(&t, NULL);
+}
+
+static uint32_t color(uint8_t id){
+    color_t c = particle_color(id, 0);
+    return (uint32_t) c.r | (uint32_t) c.g << 8 | (uint32_t) c.b << 16 | (uint32_t) c.a << 24;
+}
+
+static sim_command rect_command(rect_t r, uint8_t id){
+    sim_command c = {
+        .type = command_rect,
+        .x = r.min_x, .y = r.min_y, .x1 = r.max_x, .y1 = r.max_y,
+        .brush = {id, 1.0f}
+    };
+    return c;
+}
+
+// The whole world is filled with sand and emptied in turns,
+// once per frame taken. Every tick runs on a world of one
+// material, so a frame mixing the two or changing while held
+// was torn.
+static void check_handoff(){
+    sand_simulation *sim = sim_create(__width, __height);
+    check(sim, "could not create the handoff world");
+    if(!sim) return;
+    sim_thread *t = sim_thread_start(sim, (sim_schedule){1000.0, 4, 1.0 / 30.0});
+    check(t, "could not start the handoff thread");
+    if(!t){
+        sim_destroy(sim);
+        return;
+    }
+
+    int n = __width * __height;
+    uint32_t *held = (uint32_t *) malloc(sizeof(uint32_t) * n);
+    rect_t all = {.min_x = 0, .min_y = 0, .max_x = __width, .max_y = __height};
+    uint32_t empty = color(empty_id);
+    uint32_t sand = color(sand_id);
+    unsigned long long last_tick = 0;
+    int frames = 0;
+    int filled = 0;
+    int sent = 0;
+    double end = now_seconds() + __deadline;
+
+    while(held && frames < __frames && now_seconds() < end){
+        if(!sent){
+            sent = sim_thread_send(t, rect_command(all, filled ? empty_id : sand_id));
+            filled = !filled;
+        }
+
+        const sim_frame *f = sim_thread_frame(t);
+        if(!f){
+            sleep_ms(1);
+            continue;
+        }
+        frames++;
+        sent = 0;
+        check(f->tick > last_tick, "frame of tick %llu came after tick %llu", f->tick, last_tick);
+        last_tick = f->tick;
+
+        memcpy(held, f->pixels, sizeof(uint32_t) * n);
+        check(held[0] == empty || held[0] == sand, "frame of tick %llu starts with %08x", f->tick, held[0]);
+        int torn = 0;
+        for(int i = 1; i < n; i++){
+            if(held[i] != held[0]) torn = 1;
+        }
+        check(!torn, "frame of tick %llu mixes two worlds", f->tick);
+
+        // The thread keeps publishing while the frame is held
+        sleep_ms(3);
+        check(!memcmp(held, f->pixels, sizeof(uint32_t) * n), "frame of tick %llu changed while held", f->tick);
+    }
+    check(frames == __frames, "only %d frames were taken", frames);
+
+    sim_thread_stop(t);
+    sim_destroy(sim);
+    free(held);
+}
+
+// Random rectangles of sand, water and empty cells keep the
+// world moving. The frame is taken at uneven intervals, so
+// some are skipped and their changes must carry over.
+static void check_changed(){
+    sand_simulation *sim = sim_create(__width, __height);
+    check(sim, "could not create the changed world");
+    if(!sim) return;
+    sim_thread *t = sim_thread_start(sim, (sim_schedule){1000.0, 4, 1.0 / 30.0});
+    check(t, "could not start the changed thread");
+    if(!t){
+        sim_destroy(sim);
+        return;
+    }
+
+    static const uint8_t ids[] = {empty_id, sand_id, water_id};
+    int n = __width * __height;
+    uint32_t *last = (uint32_t *) malloc(sizeof(uint32_t) * n);
+    int have_last = 0;
+    int frames = 0;
+    int gaps = 0;
+    unsigned long long last_tick = 0;
+    srand(7);
+    double end = now_seconds() + __deadline;
+
+    while(last && frames < __frames && now_seconds() < end){
+        rect_t r;
+        r.min_x = rand() % __width;
+        r.min_y = rand() % __height;
+        r.max_x = r.min_x + 1 + rand() % 16;
+        r.max_y = r.min_y + 1 + rand() % 16;
+        sim_thread_send(t, rect_command(r, ids[rand() % 3]));
+        sleep_ms(rand() % 8);
+
+        const sim_frame *f = sim_thread_frame(t);
+        if(!f) continue;
+        frames++;
+        gaps += have_last && f->tick > last_tick + 1;
+        last_tick = f->tick;
+
+        const uint32_t *pixels = (const uint32_t *) f->pixels;
+        if(have_last){
+            int outside = 0;
+            for(int y = 0; y < __height; y++){
+                for(int x = 0; x < __width; x++){
+                    int i = y * __width + x;
+                    int inside = x >= f->changed.min_x && x < f->changed.max_x
+                        && y >= f->changed.min_y && y < f->changed.max_y;
+                    if(pixels[i] != last[i] && !inside) outside++;
+                }
+            }
+            check(!outside, "%d pixels changed outside (%d, %d)-(%d, %d) by tick %llu", outside,
+                f->changed.min_x, f->changed.min_y, f->changed.max_x, f->changed.max_y, f->tick);
+        }
+        memcpy(last, pixels, sizeof(uint32_t) * n);
+        have_last = 1;
+    }
+    check(frames == __frames, "only %d frames were taken", frames);
+    check(gaps > 0, "no tick went untaken, changes were never carried over");
+    sim_thread_stop(t);
+    sim_destroy(sim);
+    free(last);
+}
+
+// Far more ticks per second than can run, every frame must
+// cap its batch at max_substeps and the rest is dropped
+static void check_substeps(){
+    sand_simulation *sim = sim_create(__width, __height);
+    check(sim, "could not create the substep world");
+    if(!sim) return;
+    sim_paint_rect(sim, (rect_t){.min_x = 0, .min_y = __height / 2, .max_x = __width, .max_y = __height}, (brush_t){water_id, 0.5f});
+    sim_thread *t = sim_thread_start(sim, (sim_schedule){1e7, 3, 1.0});
+    check(t, "could not start the substep thread");
+    if(!t){
+        sim_destroy(sim);
+        return;
+    }
+    double end = now_seconds() + __run_time;
+    while(now_seconds() < end){
+        sim_thread_frame(t);
+        sleep_ms(5);
+    }
+
+    // Read while the thread runs, the batch in flight may be
+    // counted in ticks but not yet in frames
+    sim_thread_stats stats = sim_thread_get_stats(t);
+    sim_thread_stop(t);
+    check(stats.frames > 0, "no frame was published");
+    check(stats.ticks <= 3 * (stats.frames + 1), "%llu ticks ran in %llu frames of at most 3", stats.ticks, stats.frames);
+    check(stats.ticks > stats.frames, "every frame ran a single tick");
+    check(stats.dropped_ticks > 0, "no tick was dropped");
+    sim_destroy(sim);
+}
+
+int main(){
+    check_handoff();
+    check_changed();
+    check_substeps();
+    return check_failures ? 1 : 0;
+}
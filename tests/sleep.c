@@ -0,0 +1,83 @@
+#include "particle.h"
+#include "brush.h"
+#include "check.h"
+
+// A settled pile stops running kernels once its grains slept,
+// even while its chunk stays dirty, and taking a cell from
+// under it wakes it and it falls in
+
+#define __width     32
+#define __height    48
+#define __block     20
+#define __ticks     200
+
+// Sleeping is what the test is about, set here to match
+// particle.c
+#define __sleep_ticks 4
+
+// Kernels run by one step
+static unsigned long long step(sand_simulation *sim){
+    unsigned long long before = sim->updated_cells;
+    sim_step(sim);
+    return sim->updated_cells - before;
+}
+
+// Recolours a grain, which wakes the 3x3 block around it
+static void recolor(sand_simulation *sim, int x, int y){
+    int i = y * sim->width + x;
+    particle_t p = p_get(sim, i);
+    p.variant ^= 1;
+    p_set(sim, p, i);
+}
+
+int main(){
+    sand_simulation *sim = sim_create(__width, __height);
+    check(sim, "could not create the world");
+    if(!sim) return 1;
+    sim_seed(sim, 9);
+
+    // A block lying on the floor, across the whole world and
+    // all in one chunk
+    sim_paint_rect(sim, (rect_t){.min_x = 0, .min_y = 0, .max_x = __width, .max_y = __block}, (brush_t){sand_id, 1.0f});
+    check(step(sim) > 0, "the painted block ran no kernel");
+    int settled = 0;
+    for(int k = 0; k < __ticks && !settled; k++){
+        settled = step(sim) == 0;
+    }
+    check(settled, "the block still runs kernels after %d ticks", __ticks);
+
+    // Grains at opposite corners are recoloured every tick so
+    // the dirty rectangle covers the whole block. Once the
+    // rest slept only the two 3x3 blocks around them may run.
+    for(int k = 0; k < __sleep_ticks + 20; k++){
+        recolor(sim, 0, 0);
+        recolor(sim, __width - 1, __block - 1);
+        unsigned long long visited = sim->visited_cells;
+        unsigned long long updated = step(sim);
+        check(sim->visited_cells - visited >= __width * __block, "the block wasn't swept on tick %d", k);
+        if(k > __sleep_ticks){
+            check(updated <= 2 * 9, "%llu kernels ran on tick %d after the block slept", updated, k);
+        }
+    }
+
+    // Taking out a grain under the pile wakes the grains
+    // around it and the one above falls in
+    int x = __width / 2;
+    p_set(sim, new_empty(), x);
+    check(step(sim) > 0, "emptying a supporting cell woke nothing");
+    int refilled = 0;
+    for(int k = 0; k < 20 && !refilled; k++){
+        step(sim);
+        refilled = sim->ids[x] == sand_id;
+    }
+    check(refilled, "the emptied cell under the pile was never refilled");
+
+    // and the pile settles again
+    int resettled = 0;
+    for(int k = 0; k < __ticks && !resettled; k++){
+        resettled = step(sim) == 0;
+    }
+    check(resettled, "the pile never settled again");
+    sim_destroy(sim);
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "snapshot.h"
+#include "tools.h"
+#include "check.h"
+
+// Worlds saved and loaded both ways step on exactly like the
+// world they were saved from, damaged files are rejected
+
+#define __width     200
+#define __height    150
+#define __ticks     60
+
+// Offsets in the snapshot header
+#define __version_offset    8
+#define __planes_offset     56
+
+static int same_world(sand_simulation *a, sand_simulation *b){
+    int n = a->width * a->height;
+    if(a->width != b->width || a->height != b->height || a->tick != b->tick) return 0;
+    if(a->rng.state != b->rng.state) return 0;
+    for(int c = 0; c < a->chunks_x * a->chunks_y; c++){
+        if(a->chunks[c].rng.state != b->chunks[c].rng.state) return 0;
+    }
+    if(memcmp(a->ids, b->ids, n) || memcmp(a->variants, b->variants, n)
+        || memcmp(a->updated_tick, b->updated_tick, n) || memcmp(a->idle_ticks, b->idle_ticks, n)){
+        return 0;
+    }
+    // Empty cells don't keep velocity and life time
+    for(int i = 0; i < n; i++){
+        if(a->ids[i] != empty_id && (a->velocity_x[i] != b->velocity_x[i]
+            || a->velocity_y[i] != b->velocity_y[i] || a->life_time[i] != b->life_time[i])){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint8_t *read_file(const char *path, size_t *size){
+    FILE *f = fopen(path, "rb");
+    if(!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *) malloc(*size);
+    if(data && fread(data, 1, *size, f) != *size){
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static int write_file(const char *path, const uint8_t *data, size_t size){
+    FILE *f = fopen(path, "wb");
+    if(!f) return 0;
+    int ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+// A damaged copy must not load, from memory or from a file
+static void check_rejected(const uint8_t *data, size_t size, const char *what){
+    uint8_t *copy = (uint8_t *) malloc(size ? size : 1);
+    memcpy(copy, data, size);
+    sand_simulation *sim = sim_read_snapshot(copy, size);
+    check(!sim, "%s read from memory", what);
+    if(sim) sim_destroy(sim);
+
+    check(write_file("test-damaged.snap", copy, size), "could not write test-damaged.snap");
+    sim = sim_load("test-damaged.snap");
+    check(!sim, "%s loaded from a file", what);
+    if(sim) sim_destroy(sim);
+    free(copy);
+}
+
+static void check_damage(const char *path, int flags){
+    size_t size;
+    uint8_t *data = read_file(path, &size);
+    check(data, "could not read %s", path);
+    if(!data) return;
+
+    size_t cuts[] = {0, 1, 71, 72, 73, size / 2, size - 1};
+    for(size_t k = 0; k < sizeof(cuts) / sizeof(cuts[0]); k++){
+        char what[64];
+        snprintf(what, sizeof(what), "%s cut to %zu bytes", flags ? "compressed" : "mapped", cuts[k]);
+        check_rejected(data, cuts[k], what);
+    }
+
+    uint8_t *damaged = (uint8_t *) malloc(size);
+    uint64_t planes;
+    memcpy(&planes, &data[__planes_offset], sizeof(planes));
+
+    memcpy(damaged, data, size);
+    damaged[0] = 'X';
+    check_rejected(damaged, size, "wrong magic");
+
+    memcpy(damaged, data, size);
+    damaged[__version_offset]++;
+    check_rejected(damaged, size, "newer version");
+
+    memcpy(damaged, data, size);
+    damaged[__version_offset] = 0;
+    check_rejected(damaged, size, "version 0");
+
+    memcpy(damaged, data, size);
+    if(flags & snapshot_compressed){
+        // The end of the first block, past the end of the file
+        uint64_t end = size;
+        memcpy(&damaged[planes], &end, sizeof(end));
+        check_rejected(damaged, size, "block past the end");
+    }else{
+        // First cell of the id plane
+        damaged[planes] = 0xEE;
+        check_rejected(damaged, size, "unknown material");
+    }
+
+    free(damaged);
+    free(data);
+}
+
+int main(){
+    sand_simulation *sim = sim_create(__width, __height);
+    check(sim, "could not create a world");
+    if(!sim) return 1;
+    sim_seed(sim, 9);
+    fill_world(sim, __height / 2, __height - 1);
+    sim_set_threads(sim, 4);
+    for(int t = 0; t < __ticks; t++){
+        sim_step(sim);
+    }
+
+    const char *paths[2] = {"test-mapped.snap", "test-compressed.snap"};
+    int flags[2] = {0, snapshot_compressed};
+    sand_simulation *loaded[2];
+    for(int k = 0; k < 2; k++){
+        check(sim_save(sim, paths[k], flags[k]), "could not save %s", paths[k]);
+        loaded[k] = sim_load(paths[k]);
+        check(loaded[k], "could not load %s", paths[k]);
+        if(!loaded[k]) return 1;
+        check(same_world(sim, loaded[k]), "%s loads another world", paths[k]);
+        sim_set_threads(loaded[k], k ? 1 : 4);
+    }
+    check(loaded[0]->planes_memory, "an uncompressed snapshot isn't mapped");
+    check(!loaded[1]->planes_memory, "a compressed snapshot is mapped");
+
+    // Keep stepping all three side by side
+    for(int t = 0; t < __ticks; t++){
+        sim_step(sim);
+        for(int k = 0; k < 2; k++){
+            sim_step(loaded[k]);
+            check(same_world(sim, loaded[k]), "%s steps apart at tick %d", paths[k], t);
+        }
+    }
+
+    for(int k = 0; k < 2; k++){
+        check_damage(paths[k], flags[k]);
+        sim_destroy(loaded[k]);
+        remove(paths[k]);
+    }
+    remove("test-damaged.snap");
+    check(!sim_load("test-missing.snap"), "a missing file loads");
+
+    sim_destroy(sim);
+    return check_failures ? 1 : 0;
+}
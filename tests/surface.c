@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include "particle.h"
+#include "brush.h"
+#include "tools.h"
+#include "check.h"
+
+// The surface index must answer the same as a scan of the id
+// plane after any mix of painting, single cell writes, swaps
+// and steps, on one thread and on several
+
+#define __rounds 60
+
+static int filled(sand_simulation *sim, int x, int y){
+    return sim->ids[y * sim->width + x] != empty_id;
+}
+
+// Compares every query against the id plane, returns 1 if
+// the world matched
+static int compare(sand_simulation *sim, const char *what){
+    int failures = check_failures;
+
+    for(int y = 0; y < sim->height; y++){
+        for(int w = 0; w < sim->row_words; w++){
+            uint64_t bits = 0;
+            for(int b = 0; b < 64 && w * 64 + b < sim->width; b++){
+                if(filled(sim, w * 64 + b, y)) bits |= (uint64_t) 1 << b;
+            }
+            uint64_t word = sim->occupied[y * sim->row_words + w];
+            check(word == bits, "%s: occupied word %d of row %d is %llx, not %llx",
+                what, w, y, (unsigned long long) word, (unsigned long long) bits);
+        }
+    }
+    for(int x = 0; x < sim->width; x++){
+        int top = sim->height;
+        while(top > 0 && !filled(sim, x, top - 1)) top--;
+        int empty = 0;
+        while(empty < sim->height && filled(sim, x, empty)) empty++;
+        check(sim_column_top(sim, x) == top, "%s: column %d top is %d, not %d", what, x, sim_column_top(sim, x), top);
+        check(sim_column_first_empty(sim, x) == empty, "%s: column %d first empty is %d, not %d",
+            what, x, sim_column_first_empty(sim, x), empty);
+    }
+    // Ranges may start left of the world and end past it
+    for(int k = 0; k < 200; k++){
+        int y = rand() % sim->height;
+        int x0 = rand() % (sim->width + 80) - 40;
+        int x1 = x0 + rand() % 150;
+        int clear = 1;
+        for(int x = x0 < 0 ? 0 : x0; x < x1 && x < sim->width; x++){
+            if(filled(sim, x, y)) clear = 0;
+        }
+        check(sim_row_clear(sim, y, x0, x1) == clear, "%s: row %d over [%d, %d) clear is %d, not %d",
+            what, y, x0, x1, sim_row_clear(sim, y, x0, x1), clear);
+    }
+    return failures == check_failures;
+}
+
+static void paint(sand_simulation *sim){
+    static const uint8_t ids[] = {empty_id, sand_id, water_id, coal_id, oil_id, fire_id};
+    brush_t brush = {ids[rand() % 6], (rand() % 4 + 1) / 4.0f};
+    int x = rand() % sim->width;
+    int y = rand() % sim->height;
+    int x1 = rand() % sim->width;
+    int y1 = rand() % sim->height;
+
+    switch(rand() % 5){
+    case 0:
+        sim_paint_circle(sim, x, y, rand() % 12, brush);
+        break;
+    case 1:
+        sim_paint_line(sim, x, y, x1, y1, rand() % 4, brush);
+        break;
+    case 2:
+        sim_paint_rect(sim, (rect_t){.min_x = x, .min_y = y, .max_x = x + rand() % 40, .max_y = y + rand() % 20}, brush);
+        break;
+    case 3:
+        p_set(sim, new_particle(brush.id, &sim->chunks[0].rng), y * sim->width + x);
+        break;
+    default:
+        p_swap(sim, p_get(sim, y * sim->width + x), y1 * sim->width + x1, y * sim->width + x);
+        break;
+    }
+}
+
+int main(){
+    int sizes[][2] = {{128, 96}, {100, 70}, {65, 131}, {200, 40}};
+    int threads[] = {1, 4};
+
+    srand(5);
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++){
+            int width = sizes[s][0];
+            int height = sizes[s][1];
+            sand_simulation *sim = sim_create(width, height);
+            check(sim, "could not create a %dx%d world", width, height);
+            if(!sim) return 1;
+            sim_seed(sim, 3);
+            sim_set_threads(sim, threads[t]);
+            compare(sim, "new world");
+
+            fill_world(sim, height / 4, height / 2);
+            int ok = compare(sim, "filled world");
+            for(int r = 0; r < __rounds && ok; r++){
+                for(int k = rand() % 4; k > 0; k--){
+                    paint(sim);
+                }
+                ok = compare(sim, "painted");
+                for(int k = rand() % 6; k > 0 && ok; k--){
+                    sim_step(sim);
+                    ok = compare(sim, "stepped");
+                }
+            }
+            if(ok){
+                sim_reindex(sim);
+                compare(sim, "reindexed");
+                sim_clear(sim);
+                compare(sim, "cleared");
+            }
+            sim_destroy(sim);
+        }
+    }
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+#include "particle.h"
+#include "brush.h"
+#include "tools.h"
+#include "check.h"
+
+// The same seeded world stepped on one thread and on several
+// must stay identical cell for cell, including worlds whose
+// size isn't a multiple of chunk_size
+
+#define __ticks 200
+
+static sand_simulation *make_world(int width, int height, int threads){
+    sand_simulation *sim = sim_create(width, height);
+    if(!sim) return NULL;
+    sim_seed(sim, 21);
+    fill_world(sim, height / 3, 2 * height / 3);
+    sim_paint_rect(sim, (rect_t){.min_x = 0, .min_y = 0, .max_x = width / 2, .max_y = height / 6}, (brush_t){water_id, 0.8f});
+    sim_paint_circle(sim, width / 2, 3 * height / 4, height / 8, (brush_t){sand_id, 1.0f});
+    sim_set_threads(sim, threads);
+    return sim;
+}
+
+// Returns the first plane that differs, NULL if none does
+static const char *difference(sand_simulation *a, sand_simulation *b){
+    int n = a->width * a->height;
+    if(a->tick != b->tick) return "tick";
+    if(memcmp(a->ids, b->ids, n)) return "ids";
+    if(memcmp(a->variants, b->variants, n)) return "variants";
+    if(memcmp(a->updated_tick, b->updated_tick, n)) return "updated_tick";
+    if(memcmp(a->idle_ticks, b->idle_ticks, n)) return "idle_ticks";
+    for(int i = 0; i < n; i++){
+        if(a->ids[i] == empty_id) continue;
+        if(a->velocity_x[i] != b->velocity_x[i] || a->velocity_y[i] != b->velocity_y[i]) return "velocity";
+        if(a->life_time[i] != b->life_time[i]) return "life_time";
+    }
+    for(int c = 0; c < a->chunks_x * a->chunks_y; c++){
+        if(a->chunks[c].rng.state != b->chunks[c].rng.state) return "chunk generators";
+    }
+    if(a->fire_count != b->fire_count || memcmp(a->fires, b->fires, sizeof(int) * a->fire_count)) return "fire list";
+    return NULL;
+}
+
+int main(){
+    int sizes[][2] = {{128, 128}, {100, 70}, {97, 161}, {33, 250}};
+    int threads[] = {3, 4};
+
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        sand_simulation *single = make_world(width, height, 1);
+        sand_simulation *many[2];
+        for(int k = 0; k < 2; k++){
+            many[k] = make_world(width, height, threads[k]);
+        }
+        check(single && many[0] && many[1], "could not create %dx%d worlds", width, height);
+        if(!single || !many[0] || !many[1]) return 1;
+
+        // Only the first difference of a world is reported
+        int moved = 0;
+        int differs[2] = {0, 0};
+        for(int t = 0; t < __ticks; t++){
+            unsigned long long before = single->updated_cells;
+            sim_step(single);
+            moved |= single->updated_cells != before;
+            for(int k = 0; k < 2; k++){
+                sim_step(many[k]);
+                const char *plane = differs[k] ? NULL : difference(single, many[k]);
+                check(!plane, "%dx%d on %d threads: %s differ at tick %d", width, height, threads[k], plane, t);
+                if(plane) differs[k] = 1;
+            }
+        }
+        check(moved, "%dx%d never ran a kernel", width, height);
+
+        sim_destroy(single);
+        for(int k = 0; k < 2; k++){
+            sim_destroy(many[k]);
+        }
+    }
+    return check_failures ? 1 : 0;
+}